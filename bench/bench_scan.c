@@ -0,0 +1,200 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2025 Josh Simonot
+ */
+
+// Measures the throughput of the single pass source scanner against
+// the two pass fgets scanner it replaced (one pass for includes, a
+// second pass for the entry point). Files are given on the command
+// line and scanned repeatedly from the page cache.
+//
+//   ./bench_scan [-n iterations] files...
+
+#include "src/source_scan.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// the scanners used before the single pass scanner, kept verbatim
+
+static void legacy_foreach_include_directive(void *ctx, const char *srcpath, int (*callback)(void *ctx, const char *header, bool quoted)) {
+    FILE *file = fopen(srcpath, "r");
+    if (!file) {
+        // failure here could simply mean the header is from outside
+        // the project (systems includes). We'll skip these, assuming
+        // they wont change (often)
+        return;
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), file)) {
+
+        if (strncmp(line, "#include", 8) == 0) {
+            // get the included file name
+            char *start = strchr(line, '<');
+            if (!start) {
+                start = strchr(line, '"');
+            }
+            if (start) {
+                char *end = strchr(start + 1, (start[0] == '<') ? '>' : '"');
+                if (end) {
+                    *end = '\0';
+                    callback(ctx, start+1, start[0] == '"');
+                }
+            }
+        }
+    }
+    fclose(file);
+}
+
+static bool legacy_has_entry_point(const char *filename) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        perror("Unable to open file");
+        return false;
+    }
+    char line[1024];
+    bool in_string = false;
+    bool in_comment = false;
+    bool in_multiline_comment = false;
+    while (fgets(line, sizeof(line), file)) {
+        for (int i = 0; line[i] != '\0'; i++) {
+            if (!in_multiline_comment && !in_comment && line[i] == '\"' && (i == 0 || line[i-1] != '\\')) {
+                in_string = !in_string;
+            }
+            if (!in_string && !in_multiline_comment && line[i] == '/' && line[i+1] == '/') {
+                in_comment = true;
+                break;
+            }
+            if (!in_string && !in_multiline_comment && line[i] == '/' && line[i+1] == '*') {
+                in_multiline_comment = true;
+                i++;
+                continue;
+            }
+            if (!in_string && in_multiline_comment && line[i] == '*' && line[i+1] == '/') {
+                in_multiline_comment = false;
+                i++;
+                continue;
+            }
+            if (!in_string && !in_comment && !in_multiline_comment && strncmp(line + i, "int main(", 9) == 0) {
+                fclose(file);
+                return true;
+            }
+        }
+        in_comment = false;
+    }
+    fclose(file);
+    return false;
+}
+
+static int count_include_cb(void *ctx, const char *header, bool quoted) {
+    (void)header;
+    (void)quoted;
+    ++*(size_t*)ctx;
+    return 0;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+struct source {
+    const char *path;
+    char *data;
+    size_t size;
+};
+
+static int load_source(struct source *src, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    src->path = path;
+    src->size = size > 0 ? size : 0;
+    src->data = malloc(src->size + 1);
+    if (!src->data || fread(src->data, 1, src->size, file) != src->size) {
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+    return 0;
+}
+
+static void report(const char *name, size_t bytes, double seconds, size_t includes, size_t mains) {
+    printf("%-28s %9.1f MB/s   (%zu includes, %zu entry points)\n",
+           name, bytes / seconds / (1024.0 * 1024.0), includes, mains);
+}
+
+int main(int argc, char **argv) {
+    int iterations = 20;
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+        iterations = atoi(argv[2]);
+        first = 3;
+    }
+    if (first >= argc) {
+        printf("usage: %s [-n iterations] files...\n", argv[0]);
+        return 1;
+    }
+
+    size_t nsources = argc - first;
+    struct source *sources = calloc(nsources, sizeof *sources);
+    size_t total = 0;
+    for (size_t i = 0; i < nsources; ++i) {
+        if (load_source(&sources[i], argv[first + i]) != 0) {
+            printf("error: failed to read '%s'\n", argv[first + i]);
+            return 1;
+        }
+        total += sources[i].size;
+    }
+    printf("%zu files, %.2f MB, %d iterations\n", nsources, total / (1024.0 * 1024.0), iterations);
+
+    size_t includes = 0, mains = 0;
+    double start = now_seconds();
+    for (int it = 0; it < iterations; ++it) {
+        for (size_t i = 0; i < nsources; ++i) {
+            legacy_foreach_include_directive(&includes, sources[i].path, count_include_cb);
+            mains += legacy_has_entry_point(sources[i].path);
+        }
+    }
+    report("two pass fgets (old)", total * iterations, now_seconds() - start, includes / iterations, mains / iterations);
+
+    includes = 0, mains = 0;
+    start = now_seconds();
+    for (int it = 0; it < iterations; ++it) {
+        for (size_t i = 0; i < nsources; ++i) {
+            bool entry_point;
+            scan_source_file(sources[i].path, &includes, count_include_cb, &entry_point);
+            mains += entry_point;
+        }
+    }
+    report("single pass, from file", total * iterations, now_seconds() - start, includes / iterations, mains / iterations);
+
+    includes = 0, mains = 0;
+    start = now_seconds();
+    for (int it = 0; it < iterations; ++it) {
+        for (size_t i = 0; i < nsources; ++i) {
+            bool entry_point;
+            scan_source(sources[i].data, sources[i].size, &includes, count_include_cb, &entry_point);
+            mains += entry_point;
+        }
+    }
+    report("single pass, in memory", total * iterations, now_seconds() - start, includes / iterations, mains / iterations);
+
+    for (size_t i = 0; i < nsources; ++i) {
+        free(sources[i].data);
+    }
+    free(sources);
+    return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2025 Josh Simonot
+ */
+
+// Measures the latency of starting and reaping a command, from the
+// command line to its exit, for the ways ccbuild started commands:
+//
+//  system:       system(), as the build did first
+//  fork+sh:      fork, then exec /bin/sh -c (kept below verbatim)
+//  spawn+sh:     posix_spawn of /bin/sh -c, the shell fallback
+//  spawn argv:   posix_spawn of the tokenized template, no shell
+//
+// fork copies the page tables of the parent, so each is measured with
+// a growing amount of touched memory in the benchmark process, like a
+// build holding its dependency databases and source maps.
+//
+//   ./bench_spawn [-n spawns] [command template]
+
+#include "src/command.h"
+#include "src/process.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// the process_spawn used before posix_spawn, kept verbatim
+static pid_t legacy_process_spawn(const char *command) {
+    pid_t pid = fork();
+    if (pid == -1) {
+        printf("error: failed to start '%s'\n", command);
+        return -1;
+    }
+    if (pid == 0) {
+        execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+        _exit(127);
+    }
+    return pid;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+enum method {
+    SYSTEM,
+    FORK_SH,
+    SPAWN_SH,
+    SPAWN_ARGV,
+};
+
+static const struct command_var vars[] = {
+    { "[OBJPATH]", "build/src/main.o" },
+    { "[SRCPATH]", "src/main.c" },
+};
+
+// returns the mean latency per command in microseconds
+static double bench(enum method method, const struct command_template *tpl, int spawns) {
+    double start = now_seconds();
+    for (int i = 0; i < spawns; ++i) {
+        struct command cmd;
+        command_expand(tpl, vars, 2, &cmd);
+        int status = 0;
+        switch (method) {
+        case SYSTEM:
+            status = system(cmd.line);
+            break;
+        case FORK_SH: {
+            pid_t pid = legacy_process_spawn(cmd.line);
+            waitpid(pid, &status, 0);
+            break;
+        }
+        case SPAWN_SH: {
+            char **argv = cmd.argv;
+            cmd.argv = NULL;
+            status = process_run(&cmd);
+            cmd.argv = argv;
+            break;
+        }
+        case SPAWN_ARGV:
+            status = process_run(&cmd);
+            break;
+        }
+        command_free(&cmd);
+        if (status != 0) {
+            printf("error: command failed (%d)\n", status);
+            exit(1);
+        }
+    }
+    return (now_seconds() - start) / spawns * 1e6;
+}
+
+int main(int argc, char **argv) {
+    int spawns = 1000;
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+        spawns = atoi(argv[2]);
+        first = 3;
+    }
+    const char *text = (first < argc) ? argv[first] : "true -c [SRCPATH] -o [OBJPATH]";
+
+    struct command_template tpl;
+    command_template_init(&tpl, text);
+    if (tpl.shell) {
+        printf("error: '%s' needs the shell, nothing to compare\n", text);
+        return 1;
+    }
+    printf("'%s', %d spawns per run, microseconds per command\n", text, spawns);
+    printf("%10s %12s %12s %12s %12s\n", "resident", "system", "fork+sh", "spawn+sh", "spawn argv");
+
+    static const size_t sizes_mb[] = { 0, 64, 256, 1024 };
+    char *memory = NULL;
+    for (size_t i = 0; i < sizeof sizes_mb / sizeof sizes_mb[0]; ++i) {
+        size_t size = sizes_mb[i] << 20;
+        free(memory);
+        memory = NULL;
+        if (size > 0) {
+            memory = malloc(size);
+            if (memory == NULL) {
+                break;
+            }
+            memset(memory, 1, size);
+        }
+        printf("%8zuMB", sizes_mb[i]);
+        printf(" %12.1f", bench(SYSTEM, &tpl, spawns));
+        printf(" %12.1f", bench(FORK_SH, &tpl, spawns));
+        printf(" %12.1f", bench(SPAWN_SH, &tpl, spawns));
+        printf(" %12.1f\n", bench(SPAWN_ARGV, &tpl, spawns));
+    }
+    free(memory);
+    command_template_free(&tpl);
+    return 0;
+}
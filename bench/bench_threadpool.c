@@ -0,0 +1,346 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2025 Josh Simonot
+ */
+
+// Compares task throughput of the work stealing pool against the
+// previous single ring pool (kept below as legacy_threadpool) at
+// 1 to 64 threads, with two workloads:
+//
+//  submit: the main thread submits trivial tasks, as the directory
+//          walk does with compile tasks
+//  spawn:  tasks submit their successor from inside the pool, as
+//          chained scan -> compile -> link work does
+//
+//   ./bench_threadpool [-n tasks]
+
+#define CC_THREADPOOL_IMPLEMENTATION
+#include "libcc/cc_threadpool.h"
+
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LEGACY_THREADPOOL_QUEUE_CAPACITY 128
+#define LEGACY_THREADPOOL_MAX_THREADS 64
+
+struct legacy_task {
+    cc_task_func func;
+    void* ctx;
+};
+
+struct legacy_threadpool {
+    size_t nthreads;
+    size_t head;
+    size_t tail;
+    sem_t empty_slots;
+    sem_t filled_slots;
+    pthread_mutex_t nq_lock;
+    pthread_mutex_t dq_lock;
+    struct legacy_task tasks[LEGACY_THREADPOOL_QUEUE_CAPACITY];
+    pthread_t threads[LEGACY_THREADPOOL_MAX_THREADS];
+};
+
+
+static void legacy_enqueue_task(struct legacy_threadpool* queue, struct legacy_task *t) {
+    sem_wait(&queue->empty_slots);
+
+    pthread_mutex_lock(&queue->nq_lock);
+    queue->tasks[queue->tail] = *t;
+    queue->tail = (queue->tail + 1) % LEGACY_THREADPOOL_QUEUE_CAPACITY;
+    pthread_mutex_unlock(&queue->nq_lock);
+
+    sem_post(&queue->filled_slots);
+}
+
+static void legacy_enqueue_fence_tasks(struct legacy_threadpool* queue, struct legacy_task *t) {
+    // all fence tasks must be grouped together, no other tasks interleaved
+    // so claim enough space for all fence tasks
+    for (size_t i = 0; i < queue->nthreads; i++) {
+        sem_wait(&queue->empty_slots);
+    }
+    // then add all with same lock
+    pthread_mutex_lock(&queue->nq_lock);
+
+    for (size_t i = 0; i < queue->nthreads; i++) {
+        queue->tasks[queue->tail] = *t;
+        queue->tail = (queue->tail + 1) % LEGACY_THREADPOOL_QUEUE_CAPACITY;
+    }
+    pthread_mutex_unlock(&queue->nq_lock);
+
+    for (size_t i = 0; i < queue->nthreads; i++) {
+        sem_post(&queue->filled_slots);
+    }
+}
+
+static struct legacy_task legacy_dequeue_task(struct legacy_threadpool* queue) {
+    sem_wait(&queue->filled_slots);
+
+    pthread_mutex_lock(&queue->dq_lock);
+    struct legacy_task t = queue->tasks[queue->head];
+    queue->head = (queue->head + 1) % LEGACY_THREADPOOL_QUEUE_CAPACITY;
+    pthread_mutex_unlock(&queue->dq_lock);
+
+    sem_post(&queue->empty_slots);
+    return t;
+}
+
+static void* legacy_worker_thread(void* arg) {
+    struct legacy_threadpool* pool = (struct legacy_threadpool*)arg;
+    for (;;) {
+        struct legacy_task t = legacy_dequeue_task(pool);
+        if (t.func == NULL) {
+            // exit signal
+            break;
+        }
+        t.func(t.ctx);
+    }
+    return NULL;
+}
+
+int legacy_threadpool_init(struct legacy_threadpool* pool, size_t nthreads) {
+    assert(pool != NULL);
+
+    if (nthreads > LEGACY_THREADPOOL_MAX_THREADS) {
+        printf("error: reached max threads: LEGACY_THREADPOOL_MAX_THREADS(%d) > nthreads(%zu)\n", LEGACY_THREADPOOL_MAX_THREADS, nthreads);
+        printf("       can rebuild with custom define LEGACY_THREADPOOL_MAX_THREADS\n");
+        printf("       to increase limit\n");
+        return EINVAL;
+    }
+
+    memset(pool, 0, sizeof*pool);
+
+    sem_init(&pool->empty_slots, 0, LEGACY_THREADPOOL_QUEUE_CAPACITY);
+    sem_init(&pool->filled_slots, 0, 0);
+
+    pthread_mutex_init(&pool->nq_lock, NULL);
+    pthread_mutex_init(&pool->dq_lock, NULL);
+
+    pool->head = 0;
+    pool->tail = 0;
+    pool->nthreads = nthreads;
+
+    for (size_t i = 0; i < nthreads; i++) {
+        pthread_create(&pool->threads[i], NULL, legacy_worker_thread, pool);
+    }
+    return 0;
+}
+
+int legacy_threadpool_submit(struct legacy_threadpool* pool, void* ctx, cc_task_func func) {
+    assert(pool != NULL);
+    assert(pool->nthreads > 0);
+
+    if (func == NULL) {
+        return EINVAL;
+    }
+    legacy_enqueue_task(pool, &(struct legacy_task){
+        .func = func,
+        .ctx = ctx,
+    });
+    return 0;
+}
+
+struct legacy_fence_ctx {
+    pthread_cond_t cond;
+    pthread_mutex_t mutex;
+    size_t active_threads;
+    sem_t fences_cleared;
+};
+
+static void legacy_fenced_wait(void* arg) {
+    struct legacy_fence_ctx* ctx = arg;
+    // all threads must block except for the last one,
+    // which will signal all pool threads to continue
+    pthread_mutex_lock(&ctx->mutex);
+    ctx->active_threads--;
+
+    if (ctx->active_threads == 0) {
+        pthread_cond_broadcast(&ctx->cond);
+
+    } else {
+        while (ctx->active_threads > 0) {
+            pthread_cond_wait(&ctx->cond, &ctx->mutex);
+        }
+    }
+    pthread_mutex_unlock(&ctx->mutex);
+
+    // must be done with ctx after clearing fence,
+    // the main thread will destroy and free it
+    sem_post(&ctx->fences_cleared);
+}
+
+void legacy_threadpool_fenced_wait(struct legacy_threadpool* pool) {
+    assert(pool != NULL);
+
+    // each fence added needs its own context
+    struct legacy_fence_ctx *ctx = calloc(1, sizeof(*ctx));
+
+    pthread_mutex_init(&ctx->mutex, NULL);
+    pthread_cond_init(&ctx->cond, NULL);
+
+    sem_init(&ctx->fences_cleared, 0, 0);
+    ctx->active_threads = pool->nthreads;
+
+    // Submit a fence task for each pool thread, each fence task
+    // will block a thread from proceeding until all threads
+    // are blocked, then all threads are signaled to continue
+    legacy_enqueue_fence_tasks(pool, &(struct legacy_task){
+        .func = legacy_fenced_wait,
+        .ctx = ctx,
+    });
+
+    // wait for all fences to clear
+    for (size_t i = 0; i < pool->nthreads; ++i) {
+        sem_wait(&ctx->fences_cleared);
+    }
+
+    pthread_mutex_destroy(&ctx->mutex);
+    sem_destroy(&ctx->fences_cleared);
+    pthread_cond_destroy(&ctx->cond);
+    free(ctx);
+}
+
+void legacy_threadpool_stop_and_wait(struct legacy_threadpool* pool) {
+    assert(pool != NULL);
+
+    // Submit "stop" tasks for each worker thread
+    for (size_t i = 0; i < pool->nthreads; i++) {
+        legacy_enqueue_task(pool, &(struct legacy_task){
+            .func = NULL,
+            .ctx = NULL,
+        });
+    }
+
+    // wait
+    for (size_t i = 0; i < pool->nthreads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    // clean up
+    sem_destroy(&pool->empty_slots);
+    sem_destroy(&pool->filled_slots);
+    pthread_mutex_destroy(&pool->nq_lock);
+    pthread_mutex_destroy(&pool->dq_lock);
+    pool->nthreads = 0;
+}
+
+
+// both pools behind one interface
+struct bench_pool {
+    const char* name;
+    void* pool;
+    int (*init)(void* pool, size_t nthreads);
+    int (*submit)(void* pool, void* ctx, cc_task_func func);
+    void (*stop)(void* pool);
+};
+
+static int ws_init(void* pool, size_t n) { return cc_threadpool_init(pool, n); }
+static int ws_submit(void* pool, void* ctx, cc_task_func func) { return cc_threadpool_submit(pool, ctx, func); }
+static void ws_stop(void* pool) { cc_threadpool_stop_and_wait(pool); }
+
+static int legacy_init(void* pool, size_t n) { return legacy_threadpool_init(pool, n); }
+static int legacy_submit(void* pool, void* ctx, cc_task_func func) { return legacy_threadpool_submit(pool, ctx, func); }
+static void legacy_stop(void* pool) { legacy_threadpool_stop_and_wait(pool); }
+
+struct bench_ctx {
+    struct bench_pool* pool;
+    atomic_long completed;
+    atomic_long remaining; // tasks the spawn chains may still create
+};
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// polls instead of fencing since the legacy fence can't
+// see tasks submitted after it
+static void wait_completed(struct bench_ctx* ctx, long total) {
+    while (atomic_load(&ctx->completed) < total) {
+        usleep(50);
+    }
+}
+
+static void trivial_task(void* arg) {
+    struct bench_ctx* ctx = arg;
+    atomic_fetch_add(&ctx->completed, 1);
+}
+
+static void chain_task(void* arg) {
+    struct bench_ctx* ctx = arg;
+    if (atomic_fetch_sub(&ctx->remaining, 1) > 0) {
+        ctx->pool->submit(ctx->pool->pool, ctx, chain_task);
+    }
+    atomic_fetch_add(&ctx->completed, 1);
+}
+
+static double bench_submit(struct bench_pool* pool, size_t nthreads, long ntasks) {
+    struct bench_ctx ctx = { .pool = pool };
+    pool->init(pool->pool, nthreads);
+
+    double start = now_sec();
+    for (long i = 0; i < ntasks; ++i) {
+        pool->submit(pool->pool, &ctx, trivial_task);
+    }
+    wait_completed(&ctx, ntasks);
+    double elapsed = now_sec() - start;
+
+    pool->stop(pool->pool);
+    return ntasks / elapsed;
+}
+
+static double bench_spawn(struct bench_pool* pool, size_t nthreads, long ntasks) {
+    // few enough chains that the legacy ring never fills up, a full
+    // ring deadlocks it when workers submit
+    long nchains = 4 * (long)nthreads;
+    if (nchains > LEGACY_THREADPOOL_QUEUE_CAPACITY / 2) {
+        nchains = LEGACY_THREADPOOL_QUEUE_CAPACITY / 2;
+    }
+    struct bench_ctx ctx = { .pool = pool };
+    atomic_store(&ctx.remaining, ntasks - nchains);
+    pool->init(pool->pool, nthreads);
+
+    double start = now_sec();
+    for (long i = 0; i < nchains; ++i) {
+        pool->submit(pool->pool, &ctx, chain_task);
+    }
+    wait_completed(&ctx, ntasks);
+    double elapsed = now_sec() - start;
+
+    pool->stop(pool->pool);
+    return ntasks / elapsed;
+}
+
+int main(int argc, char** argv) {
+    long ntasks = 1000000;
+    if (argc == 3 && strcmp(argv[1], "-n") == 0) {
+        ntasks = atol(argv[2]);
+    }
+
+    static struct cc_threadpool ws_pool;
+    static struct legacy_threadpool legacy_pool;
+    struct bench_pool pools[] = {
+        { "ring", &legacy_pool, legacy_init, legacy_submit, legacy_stop },
+        { "stealing", &ws_pool, ws_init, ws_submit, ws_stop },
+    };
+
+    printf("%ld tasks per run, million tasks/sec\n", ntasks);
+    printf("%8s %14s %14s %14s %14s\n", "threads", "submit ring", "submit steal", "spawn ring", "spawn steal");
+
+    for (size_t nthreads = 1; nthreads <= 64; nthreads *= 2) {
+        printf("%8zu", nthreads);
+        printf(" %14.2f", bench_submit(&pools[0], nthreads, ntasks) / 1e6);
+        printf(" %14.2f", bench_submit(&pools[1], nthreads, ntasks) / 1e6);
+        printf(" %14.2f", bench_spawn(&pools[0], nthreads, ntasks) / 1e6);
+        printf(" %14.2f", bench_spawn(&pools[1], nthreads, ntasks) / 1e6);
+        printf("\n");
+        fflush(stdout);
+    }
+    return 0;
+}
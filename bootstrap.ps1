@@ -9,7 +9,17 @@ New-Item -Path ".\install\bootstrap" -ItemType Directory -Force
     .\libcc\cc_trie_map.c `
     .\libcc\cc_threadpool.c `
     .\libcc\cc_files.c `
+    .\libcc\cc_hash.c `
+    .\libcc\cc_taskgraph.c `
     .\src\str_list.c `
+    .\src\depdb.c `
+    .\src\include_resolver.c `
+    .\src\source_scan.c `
+    .\src\obj_symbols.c `
+    .\src\command.c `
+    .\src\process.c `
+    .\src\jobserver.c `
+    .\src\executor.c `
     .\src\build_opts.c `
     .\src\cmd_build.c `
     .\src\cmd_clean.c `
@@ -8,12 +8,26 @@
 #ifndef _CC_FILES_H
 #define _CC_FILES_H
 
+#include "cc_strings.h"
+
 #include <time.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <string.h>
+#include <stdint.h>
+
+// cheap identity of a file's contents, compared between builds
+// to decide if a file needs to be looked at again. All fields
+// are -1 if the file does not exist (inode is 0 where the
+// platform has no such concept)
+struct ccfs_stamp {
+    int64_t mtime_ns;
+    int64_t size;
+    uint64_t inode;
+};
 
 time_t ccfs_last_modified_time(const char *filepath);
+int ccfs_file_stamp(const char *filepath, struct ccfs_stamp *stamp);
 bool ccfs_is_regular_file(const char *path);
 bool ccfs_is_directory(const char *path);
 int ccfs_cwd(char *outp, size_t bufsize);
@@ -23,6 +37,19 @@ int ccfs_rmdir_recursive(const char *path);
 
 int ccfs_iterate_files(const char *directory, void *ctx, int (*callback)(void *ctx, const char *filepath));
 
+// files smaller than this are read into a heap buffer,
+// setting up a mapping costs more than copying them
+#ifndef CCFS_MAP_THRESHOLD
+#define CCFS_MAP_THRESHOLD (64 * 1024)
+#endif
+
+// gives read only access to the whole contents of a file without
+// copying it (when large enough to be memory mapped), the view is
+// valid until passed to ccfs_unmap and is not null terminated.
+// Returns 0 on success, or an errno value
+int ccfs_map_readonly(const char *filepath, ccstrview *view);
+void ccfs_unmap(ccstrview *view);
+
 #endif // _CC_FILES_H
 
 #ifdef CC_FILES_IMPLEMENTATION
@@ -31,6 +58,8 @@ int ccfs_iterate_files(const char *directory, void *ctx, int (*callback)(void *c
 #include <dirent.h>
 #include <errno.h>
 #include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 // set default logging
@@ -41,6 +70,9 @@ int ccfs_iterate_files(const char *directory, void *ctx, int (*callback)(void *c
 
 #ifdef _WIN32
 #include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
 #endif
 
 time_t ccfs_last_modified_time(const char *filepath) {
@@ -51,6 +83,126 @@ time_t ccfs_last_modified_time(const char *filepath) {
     return st.st_mtime;
 }
 
+int ccfs_file_stamp(const char *filepath, struct ccfs_stamp *stamp) {
+    struct stat st;
+    if (stat(filepath, &st) == -1) {
+        *stamp = (struct ccfs_stamp){ .mtime_ns = -1, .size = -1, .inode = (uint64_t)-1 };
+        return -1;
+    }
+    #if defined(__APPLE__)
+    int64_t mtime_ns = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+    #elif defined(_WIN32)
+    int64_t mtime_ns = (int64_t)st.st_mtime * 1000000000;
+    #else
+    int64_t mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    #endif
+
+    *stamp = (struct ccfs_stamp){
+        .mtime_ns = mtime_ns,
+        .size = st.st_size,
+        #if defined(_WIN32)
+        .inode = 0,
+        #else
+        .inode = st.st_ino,
+        #endif
+    };
+    return 0;
+}
+
+int ccfs_map_readonly(const char *filepath, ccstrview *view) {
+    *view = (ccstrview){0};
+
+    #ifdef _WIN32
+    FILE *file = fopen(filepath, "rb");
+    if (file == NULL) {
+        return errno;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (size < 0 || (uint64_t)size > UINT32_MAX) {
+        fclose(file);
+        return EFBIG;
+    }
+    char *buf = malloc(size + 1);
+    if (buf == NULL) {
+        fclose(file);
+        return ENOMEM;
+    }
+    size_t len = fread(buf, 1, size, file);
+    fclose(file);
+    buf[len] = 0;
+    *view = (ccstrview){ .cstr = buf, .len = len, .flags = CCSTR_FLAG_HEAP };
+    return 0;
+
+    #else
+    int fd = open(filepath, O_RDONLY);
+    if (fd == -1) {
+        return errno;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        int err = errno;
+        close(fd);
+        return err;
+    }
+    if ((uint64_t)st.st_size > UINT32_MAX) {
+        close(fd);
+        return EFBIG;
+    }
+    size_t size = st.st_size;
+
+    if (size >= CCFS_MAP_THRESHOLD) {
+        void *addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED) {
+            return errno;
+        }
+        #ifdef MADV_SEQUENTIAL
+        madvise(addr, size, MADV_SEQUENTIAL);
+        #endif
+        *view = (ccstrview){ .cstr = addr, .len = size };
+        return 0;
+    }
+
+    char *buf = malloc(size + 1);
+    if (buf == NULL) {
+        close(fd);
+        return ENOMEM;
+    }
+    size_t len = 0;
+    while (len < size) {
+        ssize_t n = pread(fd, buf + len, size - len, len);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break; // truncated while reading, keep what was read
+        }
+        len += n;
+    }
+    close(fd);
+    buf[len] = 0;
+    *view = (ccstrview){ .cstr = buf, .len = len, .flags = CCSTR_FLAG_HEAP };
+    return 0;
+    #endif
+}
+
+void ccfs_unmap(ccstrview *view) {
+    if (view->cstr == NULL) {
+        return;
+    }
+    if (view->flags & CCSTR_FLAG_HEAP) {
+        free(view->cstr);
+    }
+    #ifndef _WIN32
+    else {
+        munmap(view->cstr, view->len);
+    }
+    #endif
+    *view = (ccstrview){0};
+}
+
 bool ccfs_is_directory(const char *path) {
     struct stat path_stat;
     if (stat(path, &path_stat) != 0) {
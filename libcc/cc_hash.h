@@ -0,0 +1,197 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2025 Josh Simonot
+ */
+#ifndef _CC_HASH_H
+#define _CC_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 64 bit non-cryptographic hash, compatible with XXH64.
+// Fast enough to fingerprint file contents and command lines
+// between builds, not meant to resist deliberate collisions.
+
+struct cc_hash64_state {
+    uint64_t acc[4];
+    uint64_t total_len;
+    uint8_t buffer[32];
+    size_t buffered;
+    uint64_t seed;
+};
+
+uint64_t cc_hash64(const void *data, size_t len, uint64_t seed);
+
+// streaming interface, produces the same digest as hashing
+// all the updates concatenated in a single cc_hash64 call
+void cc_hash64_reset(struct cc_hash64_state *state, uint64_t seed);
+void cc_hash64_update(struct cc_hash64_state *state, const void *data, size_t len);
+uint64_t cc_hash64_digest(const struct cc_hash64_state *state);
+
+#endif // _CC_HASH_H
+
+#ifdef CC_HASH_IMPLEMENTATION
+
+#include <string.h>
+
+#define CC_HASH64_PRIME1 0x9E3779B185EBCA87ULL
+#define CC_HASH64_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define CC_HASH64_PRIME3 0x165667B19E3779F9ULL
+#define CC_HASH64_PRIME4 0x85EBCA77C2B2AE63ULL
+#define CC_HASH64_PRIME5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t cc_hash64_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// input is always read as little endian
+static inline uint64_t cc_hash64_read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof v);
+    #if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+    #endif
+    return v;
+}
+
+static inline uint32_t cc_hash64_read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof v);
+    #if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+    #endif
+    return v;
+}
+
+static inline uint64_t cc_hash64_round(uint64_t acc, uint64_t input) {
+    acc += input * CC_HASH64_PRIME2;
+    acc = cc_hash64_rotl(acc, 31);
+    return acc * CC_HASH64_PRIME1;
+}
+
+static inline uint64_t cc_hash64_merge(uint64_t h, uint64_t acc) {
+    h ^= cc_hash64_round(0, acc);
+    return h * CC_HASH64_PRIME1 + CC_HASH64_PRIME4;
+}
+
+// consumes all whole 32 byte stripes, returns the number of bytes consumed
+static size_t cc_hash64_stripes(uint64_t acc[4], const uint8_t *p, size_t len) {
+    size_t consumed = 0;
+    while (len - consumed >= 32) {
+        acc[0] = cc_hash64_round(acc[0], cc_hash64_read64(p + consumed));
+        acc[1] = cc_hash64_round(acc[1], cc_hash64_read64(p + consumed + 8));
+        acc[2] = cc_hash64_round(acc[2], cc_hash64_read64(p + consumed + 16));
+        acc[3] = cc_hash64_round(acc[3], cc_hash64_read64(p + consumed + 24));
+        consumed += 32;
+    }
+    return consumed;
+}
+
+static uint64_t cc_hash64_finalize(uint64_t h, const uint8_t *p, size_t len) {
+    while (len >= 8) {
+        h ^= cc_hash64_round(0, cc_hash64_read64(p));
+        h = cc_hash64_rotl(h, 27) * CC_HASH64_PRIME1 + CC_HASH64_PRIME4;
+        p += 8;
+        len -= 8;
+    }
+    if (len >= 4) {
+        h ^= (uint64_t)cc_hash64_read32(p) * CC_HASH64_PRIME1;
+        h = cc_hash64_rotl(h, 23) * CC_HASH64_PRIME2 + CC_HASH64_PRIME3;
+        p += 4;
+        len -= 4;
+    }
+    while (len > 0) {
+        h ^= (*p) * CC_HASH64_PRIME5;
+        h = cc_hash64_rotl(h, 11) * CC_HASH64_PRIME1;
+        p += 1;
+        len -= 1;
+    }
+    h ^= h >> 33;
+    h *= CC_HASH64_PRIME2;
+    h ^= h >> 29;
+    h *= CC_HASH64_PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+static void cc_hash64_init_acc(uint64_t acc[4], uint64_t seed) {
+    acc[0] = seed + CC_HASH64_PRIME1 + CC_HASH64_PRIME2;
+    acc[1] = seed + CC_HASH64_PRIME2;
+    acc[2] = seed;
+    acc[3] = seed - CC_HASH64_PRIME1;
+}
+
+static uint64_t cc_hash64_converge(const uint64_t acc[4]) {
+    uint64_t h = cc_hash64_rotl(acc[0], 1) + cc_hash64_rotl(acc[1], 7)
+               + cc_hash64_rotl(acc[2], 12) + cc_hash64_rotl(acc[3], 18);
+    h = cc_hash64_merge(h, acc[0]);
+    h = cc_hash64_merge(h, acc[1]);
+    h = cc_hash64_merge(h, acc[2]);
+    h = cc_hash64_merge(h, acc[3]);
+    return h;
+}
+
+uint64_t cc_hash64(const void *data, size_t len, uint64_t seed) {
+    const uint8_t *p = data;
+    uint64_t h;
+    size_t consumed = 0;
+
+    if (len >= 32) {
+        uint64_t acc[4];
+        cc_hash64_init_acc(acc, seed);
+        consumed = cc_hash64_stripes(acc, p, len);
+        h = cc_hash64_converge(acc);
+    } else {
+        h = seed + CC_HASH64_PRIME5;
+    }
+    h += (uint64_t)len;
+    return cc_hash64_finalize(h, p + consumed, len - consumed);
+}
+
+void cc_hash64_reset(struct cc_hash64_state *state, uint64_t seed) {
+    memset(state, 0, sizeof *state);
+    state->seed = seed;
+    cc_hash64_init_acc(state->acc, seed);
+}
+
+void cc_hash64_update(struct cc_hash64_state *state, const void *data, size_t len) {
+    const uint8_t *p = data;
+    state->total_len += len;
+
+    // top up a partial stripe first
+    if (state->buffered > 0) {
+        size_t fill = 32 - state->buffered;
+        if (fill > len) {
+            fill = len;
+        }
+        memcpy(state->buffer + state->buffered, p, fill);
+        state->buffered += fill;
+        p += fill;
+        len -= fill;
+
+        if (state->buffered < 32) {
+            return;
+        }
+        cc_hash64_stripes(state->acc, state->buffer, 32);
+        state->buffered = 0;
+    }
+    size_t consumed = cc_hash64_stripes(state->acc, p, len);
+    memcpy(state->buffer, p + consumed, len - consumed);
+    state->buffered = len - consumed;
+}
+
+uint64_t cc_hash64_digest(const struct cc_hash64_state *state) {
+    uint64_t h;
+    if (state->total_len >= 32) {
+        h = cc_hash64_converge(state->acc);
+    } else {
+        h = state->seed + CC_HASH64_PRIME5;
+    }
+    h += state->total_len;
+    return cc_hash64_finalize(h, state->buffer, state->buffered);
+}
+
+#endif // CC_HASH_IMPLEMENTATION
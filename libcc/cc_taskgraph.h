@@ -0,0 +1,200 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2025 Josh Simonot
+ */
+
+#ifndef _CC_TASKGRAPH_H
+#define _CC_TASKGRAPH_H
+
+#include "cc_threadpool.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+// Runs tasks on a thread pool in dependency order. A node is submitted
+// to the pool as soon as all nodes it depends on have completed, so
+// nothing ever waits on unrelated work.
+//
+// Nodes may be added while the graph is running, also from inside a
+// running node. A new node is held back until it is released, which
+// gives the caller the chance to add its dependencies first.
+
+struct cc_taskgraph;
+
+struct cc_task_node {
+    cc_task_func func; // may be NULL for nodes that only order others
+    void* ctx;
+    struct cc_taskgraph* graph;
+    atomic_size_t npending; // unfinished dependencies, plus one until released
+    bool done;
+
+    // nodes waiting on this one (guarded by the graph lock)
+    struct cc_task_node** successors;
+    size_t nsuccessors;
+    size_t cap;
+
+    struct cc_task_node* next; // all nodes, freed with the graph
+};
+
+struct cc_taskgraph {
+    struct cc_threadpool* pool;
+    pthread_mutex_t lock;
+    pthread_cond_t idle;
+    size_t nunfinished;
+    struct cc_task_node* nodes;
+};
+
+void cc_taskgraph_init(struct cc_taskgraph* graph, struct cc_threadpool* pool);
+
+// creates a node that runs func(ctx) once released and all of its
+// dependencies completed
+struct cc_task_node* cc_taskgraph_add(struct cc_taskgraph* graph, void* ctx, cc_task_func func);
+
+// node runs after dep completed, node must either not be released yet
+// or still depend on the calling node (dep may be in any state, a
+// completed dep is simply ignored)
+void cc_taskgraph_depend(struct cc_taskgraph* graph, struct cc_task_node* node, struct cc_task_node* dep);
+
+// no more dependencies will be added, the node runs once they completed
+void cc_taskgraph_release(struct cc_taskgraph* graph, struct cc_task_node* node);
+
+// waits until every node completed, including nodes added meanwhile,
+// must not be called from inside a node
+void cc_taskgraph_wait(struct cc_taskgraph* graph);
+
+// frees all nodes, the graph must be idle
+void cc_taskgraph_free(struct cc_taskgraph* graph);
+
+#endif // _CC_TASKGRAPH_H
+
+#ifdef CC_TASKGRAPH_IMPLEMENTATION
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void cc_taskgraph_init(struct cc_taskgraph* graph, struct cc_threadpool* pool) {
+    assert(graph != NULL);
+    assert(pool != NULL);
+
+    memset(graph, 0, sizeof(*graph));
+    graph->pool = pool;
+    pthread_mutex_init(&graph->lock, NULL);
+    pthread_cond_init(&graph->idle, NULL);
+}
+
+struct cc_task_node* cc_taskgraph_add(struct cc_taskgraph* graph, void* ctx, cc_task_func func) {
+    assert(graph != NULL);
+
+    struct cc_task_node* node = calloc(1, sizeof(*node));
+    if (node == NULL) {
+        printf("%s: out of memory\n", __func__);
+        abort();
+    }
+    node->func = func;
+    node->ctx = ctx;
+    node->graph = graph;
+    atomic_init(&node->npending, 1);
+
+    pthread_mutex_lock(&graph->lock);
+    node->next = graph->nodes;
+    graph->nodes = node;
+    graph->nunfinished++;
+    pthread_mutex_unlock(&graph->lock);
+    return node;
+}
+
+void cc_taskgraph_depend(struct cc_taskgraph* graph, struct cc_task_node* node, struct cc_task_node* dep) {
+    assert(graph != NULL && node != NULL && dep != NULL);
+    assert(node != dep);
+
+    pthread_mutex_lock(&graph->lock);
+    if (!dep->done) {
+        if (dep->nsuccessors == dep->cap) {
+            dep->cap = dep->cap ? 2 * dep->cap : 4;
+            dep->successors = realloc(dep->successors, dep->cap * sizeof(*dep->successors));
+            if (dep->successors == NULL) {
+                printf("%s: out of memory\n", __func__);
+                abort();
+            }
+        }
+        dep->successors[dep->nsuccessors++] = node;
+        atomic_fetch_add(&node->npending, 1);
+    }
+    pthread_mutex_unlock(&graph->lock);
+}
+
+static void run_node(void* arg);
+
+static void node_dependency_done(struct cc_task_node* node) {
+    if (atomic_fetch_sub(&node->npending, 1) == 1) {
+        cc_threadpool_submit(node->graph->pool, node, run_node);
+    }
+}
+
+static void run_node(void* arg) {
+    struct cc_task_node* node = arg;
+    struct cc_taskgraph* graph = node->graph;
+
+    if (node->func != NULL) {
+        node->func(node->ctx);
+    }
+
+    // no successor can be added once done is set, so the
+    // list can be walked outside the lock
+    pthread_mutex_lock(&graph->lock);
+    node->done = true;
+    pthread_mutex_unlock(&graph->lock);
+
+    for (size_t i = 0; i < node->nsuccessors; ++i) {
+        node_dependency_done(node->successors[i]);
+    }
+
+    // successors were counted when added, so the graph can't
+    // look idle before they are submitted
+    pthread_mutex_lock(&graph->lock);
+    if (--graph->nunfinished == 0) {
+        pthread_cond_broadcast(&graph->idle);
+    }
+    pthread_mutex_unlock(&graph->lock);
+}
+
+void cc_taskgraph_release(struct cc_taskgraph* graph, struct cc_task_node* node) {
+    assert(graph != NULL && node != NULL);
+    (void)graph;
+    node_dependency_done(node);
+}
+
+void cc_taskgraph_wait(struct cc_taskgraph* graph) {
+    assert(graph != NULL);
+
+    pthread_mutex_lock(&graph->lock);
+    while (graph->nunfinished > 0) {
+        pthread_cond_wait(&graph->idle, &graph->lock);
+    }
+    pthread_mutex_unlock(&graph->lock);
+}
+
+void cc_taskgraph_free(struct cc_taskgraph* graph) {
+    assert(graph != NULL);
+    assert(graph->nunfinished == 0);
+
+    struct cc_task_node* node = graph->nodes;
+    while (node != NULL) {
+        struct cc_task_node* next = node->next;
+        free(node->successors);
+        free(node);
+        node = next;
+    }
+    pthread_mutex_destroy(&graph->lock);
+    pthread_cond_destroy(&graph->idle);
+    memset(graph, 0, sizeof(*graph));
+}
+
+#endif // CC_TASKGRAPH_IMPLEMENTATION
@@ -9,49 +9,163 @@
 #ifndef _CC_THREADPOOL_H
 #define _CC_THREADPOOL_H
 
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 #include <pthread.h>
-#include <semaphore.h>
 
-#ifndef CC_THREADPOOL_QUEUE_CAPACITY
-#define CC_THREADPOOL_QUEUE_CAPACITY 128
-#endif
-
-#ifndef CC_THREADPOOL_MAX_THREADS
-#define CC_THREADPOOL_MAX_THREADS 64
+// Work stealing thread pool: each worker owns a Chase-Lev deque, tasks
+// submitted from inside a task are pushed onto the submitting worker's
+// own deque without any locking, and idle workers steal from random
+// victims. Tasks submitted from other threads go through a shared
+// injection queue.
+//
+// Neither the queues nor the number of workers have a fixed limit,
+// submitting never blocks.
+//
+// Task groups count their own outstanding tasks, so a caller can wait
+// for its group alone while the workers keep running the tasks of other
+// groups. A worker that waits on a group runs other tasks meanwhile.
+//
+// Cancelling the pool does not drop queued tasks, they may own memory
+// only they know how to free. Instead every task can check the token
+// and return early, and tasks submitted with a handle are not run at
+// all, their handle reports ECANCELED.
+
+// slots per injection queue segment
+#ifndef CC_THREADPOOL_SEGMENT_SIZE
+#define CC_THREADPOOL_SEGMENT_SIZE 256
 #endif
 
 typedef void (*cc_task_func)(void*);
+typedef int (*cc_task_result_func)(void*);
+
+struct cc_task_group;
 
 struct cc_task {
     cc_task_func func;
     void* ctx;
+    struct cc_task_group* group; // may be NULL
+};
+
+// deque slots are read by thieves while the owner may be writing
+// them, a torn read is discarded by the thief's failed CAS on top
+struct cc_task_slot {
+    _Atomic(cc_task_func) func;
+    _Atomic(void*) ctx;
+    _Atomic(struct cc_task_group*) group;
+};
+
+struct cc_deque_array {
+    int64_t size; // power of two
+    struct cc_deque_array* retired; // previous (smaller) array
+    struct cc_task_slot slots[];
+};
+
+struct cc_worker {
+    _Atomic int64_t top;     // thieves take from here
+    char pad[64 - sizeof(int64_t)];
+    _Atomic int64_t bottom;  // owner pushes and pops here
+    _Atomic(struct cc_deque_array*) array;
+    struct cc_threadpool* pool;
+    uint64_t rng;
+    pthread_t thread;
+};
+
+// Injection queue: a linked list of fixed size segments. Producers and
+// consumers claim slots with fetch-and-add on the segment's indices, a
+// new segment is linked in when the last one fills up. A consumer that
+// claims a slot no producer has claimed yet marks it abandoned and the
+// producer that later claims it moves on to the next slot.
+//
+// Once both head and tail moved past a segment it is retired, and freed
+// by the next push or pop that finds no other one in progress, any that
+// could still be reading it started before it was retired.
+struct cc_queue_segment {
+    _Atomic(struct cc_queue_segment*) next;
+    struct cc_queue_segment* retired; // next on the retired list
+    atomic_int passed; // by head and tail, retired once both did
+    atomic_size_t enq_index;
+    atomic_size_t deq_index;
+    struct cc_task_slot slots[CC_THREADPOOL_SEGMENT_SIZE];
+};
+
+struct cc_task_queue {
+    _Atomic(struct cc_queue_segment*) head;
+    _Atomic(struct cc_queue_segment*) tail;
+    _Atomic(struct cc_queue_segment*) retired;
+    atomic_size_t active; // pushes and pops in progress
 };
 
 struct cc_threadpool {
-    size_t nthreads;
-    size_t head;
-    size_t tail;
-    sem_t empty_slots;
-    sem_t filled_slots;
-    pthread_mutex_t nq_lock;
-    pthread_mutex_t dq_lock;
-    struct cc_task tasks[CC_THREADPOOL_QUEUE_CAPACITY];
-    pthread_t threads[CC_THREADPOOL_MAX_THREADS];
+    size_t nthreads;         // workers, fixed once the first one started
+    size_t nstarted;         // workers whose thread was started
+    atomic_bool cancelled;
+    atomic_size_t pending;   // submitted but not yet completed
+    atomic_uint epoch;       // bumped whenever work is published
+    atomic_size_t sleepers;
+    atomic_bool stopping;
+    pthread_key_t worker_key; // identifies the calling worker, if any
+    pthread_mutex_t park_lock;
+    pthread_cond_t park_cond;
+    pthread_mutex_t done_lock;
+    pthread_cond_t done_cond;
+
+    // tasks submitted from outside the pool
+    struct cc_task_queue injected;
+    struct cc_worker* workers;
+};
+
+struct cc_task_group {
+    struct cc_threadpool* pool;
+    atomic_size_t pending; // submitted to the group but not yet completed
+};
+
+// completion of a task submitted with cc_threadpool_submit_handle,
+// lives in memory provided by the caller until the task is waited on
+struct cc_task_handle {
+    struct cc_threadpool* pool;
+    cc_task_result_func func;
+    void* ctx;
+    int result;
+    atomic_bool done;
 };
 
 // Initialize thread pool in provided memory with specified number of worker threads
 int cc_threadpool_init(struct cc_threadpool* pool, size_t num_threads);
 
-// Submit a task to be executed by the thread pool
+// Submit a task to be executed by the thread pool, may be called
+// from inside a task in which case the task is queued locally
 int cc_threadpool_submit(struct cc_threadpool* pool, void* ctx, cc_task_func func);
 
-// inserts a fence into the task queue and waits for all tasks
-// before the fence to complete
+// Submit a task whose result is carried by the handle
+int cc_threadpool_submit_handle(struct cc_threadpool* pool, struct cc_task_handle* handle, void* ctx, cc_task_result_func func);
+
+// waits for the task and returns its result, or ECANCELED if the pool
+// was cancelled before the task started, must not be called from inside a task
+int cc_task_handle_wait(struct cc_task_handle* handle);
+
+// sets the pool wide cancellation token, returns false if it was already set
+bool cc_threadpool_cancel(struct cc_threadpool* pool);
+bool cc_threadpool_cancelled(struct cc_threadpool* pool);
+
+// waits for all submitted tasks to complete, including tasks
+// they submit in turn, must not be called from inside a task
 void cc_threadpool_fenced_wait(struct cc_threadpool* pool);
 
+// Initialize a task group in provided memory, it needs no cleanup
+void cc_task_group_init(struct cc_task_group* group, struct cc_threadpool* pool);
+
+// Submit a task counted by the group, may be called from inside a task
+int cc_task_group_submit(struct cc_task_group* group, void* ctx, cc_task_func func);
+
+// waits for the tasks of the group only, tasks they submit through
+// cc_threadpool_submit are not part of the group. Called from inside a
+// task, the worker runs other tasks until the group is done
+void cc_task_group_wait(struct cc_task_group* group);
+
 // Wait for all tasks to complete and cleanup thread pool resources
 void cc_threadpool_stop_and_wait(struct cc_threadpool* pool);
 
@@ -63,59 +177,349 @@ void cc_threadpool_stop_and_wait(struct cc_threadpool* pool);
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <sched.h>
+
+#define CC_DEQUE_INITIAL_SIZE 64
+
+static struct cc_deque_array* deque_array_new(int64_t size) {
+    struct cc_deque_array* array = calloc(1, sizeof(*array) + size * sizeof(array->slots[0]));
+    if (array == NULL) {
+        printf("%s: out of memory\n", __func__);
+        abort();
+    }
+    array->size = size;
+    return array;
+}
+
+static void slot_store(struct cc_deque_array* array, int64_t i, struct cc_task t) {
+    struct cc_task_slot* slot = &array->slots[i & (array->size - 1)];
+    atomic_store_explicit(&slot->func, t.func, memory_order_relaxed);
+    atomic_store_explicit(&slot->ctx, t.ctx, memory_order_relaxed);
+    atomic_store_explicit(&slot->group, t.group, memory_order_relaxed);
+}
+
+static struct cc_task slot_load(struct cc_deque_array* array, int64_t i) {
+    struct cc_task_slot* slot = &array->slots[i & (array->size - 1)];
+    return (struct cc_task){
+        .func = atomic_load_explicit(&slot->func, memory_order_relaxed),
+        .ctx = atomic_load_explicit(&slot->ctx, memory_order_relaxed),
+        .group = atomic_load_explicit(&slot->group, memory_order_relaxed),
+    };
+}
+
+// owner only, thieves may still be reading the old array so
+// it is kept until the pool stops
+static struct cc_deque_array* deque_grow(struct cc_worker* w, struct cc_deque_array* old, int64_t top, int64_t bottom) {
+    struct cc_deque_array* array = deque_array_new(2 * old->size);
+    for (int64_t i = top; i < bottom; ++i) {
+        slot_store(array, i, slot_load(old, i));
+    }
+    array->retired = old;
+    atomic_store_explicit(&w->array, array, memory_order_release);
+    return array;
+}
+
+// The deque follows "Correct and Efficient Work-Stealing for Weak
+// Memory Models" (Le, Pop, Cohen, Zappa Nardelli, 2013)
+
+static void deque_push(struct cc_worker* w, struct cc_task t) {
+    int64_t b = atomic_load_explicit(&w->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&w->top, memory_order_acquire);
+    struct cc_deque_array* array = atomic_load_explicit(&w->array, memory_order_relaxed);
+    if (b - top > array->size - 1) {
+        array = deque_grow(w, array, top, b);
+    }
+    slot_store(array, b, t);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&w->bottom, b + 1, memory_order_relaxed);
+}
 
-static void enqueue_task(struct cc_threadpool* queue, struct cc_task *t) {
-    sem_wait(&queue->empty_slots);
+static bool deque_pop(struct cc_worker* w, struct cc_task* t) {
+    int64_t b = atomic_load_explicit(&w->bottom, memory_order_relaxed) - 1;
+    struct cc_deque_array* array = atomic_load_explicit(&w->array, memory_order_relaxed);
+    atomic_store_explicit(&w->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t top = atomic_load_explicit(&w->top, memory_order_relaxed);
+
+    if (top > b) {
+        // empty
+        atomic_store_explicit(&w->bottom, b + 1, memory_order_relaxed);
+        return false;
+    }
+    *t = slot_load(array, b);
+    if (top == b) {
+        // last task, race the thieves for it
+        bool won = atomic_compare_exchange_strong_explicit(&w->top, &top, top + 1,
+                memory_order_seq_cst, memory_order_relaxed);
+        atomic_store_explicit(&w->bottom, b + 1, memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
 
-    pthread_mutex_lock(&queue->nq_lock);
-    queue->tasks[queue->tail] = *t;
-    queue->tail = (queue->tail + 1) % CC_THREADPOOL_QUEUE_CAPACITY;
-    pthread_mutex_unlock(&queue->nq_lock);
+static bool deque_steal(struct cc_worker* w, struct cc_task* t) {
+    int64_t top = atomic_load_explicit(&w->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t b = atomic_load_explicit(&w->bottom, memory_order_acquire);
+    if (top >= b) {
+        return false;
+    }
+    struct cc_deque_array* array = atomic_load_explicit(&w->array, memory_order_acquire);
+    *t = slot_load(array, top);
+    return atomic_compare_exchange_strong_explicit(&w->top, &top, top + 1,
+            memory_order_seq_cst, memory_order_relaxed);
+}
 
-    sem_post(&queue->filled_slots);
+// wakes a parked worker after work was published, only takes
+// the lock when some worker is actually parked
+static void wake_worker(struct cc_threadpool* pool) {
+    atomic_fetch_add(&pool->epoch, 1);
+    if (atomic_load(&pool->sleepers) > 0) {
+        pthread_mutex_lock(&pool->park_lock);
+        pthread_cond_signal(&pool->park_cond);
+        pthread_mutex_unlock(&pool->park_lock);
+    }
 }
 
-static void enqueue_fence_tasks(struct cc_threadpool* queue, struct cc_task *t) {
-    // all fence tasks must be grouped together, no other tasks interleaved
-    // so claim enough space for all fence tasks
-    for (size_t i = 0; i < queue->nthreads; i++) {
-        sem_wait(&queue->empty_slots);
+// marks a slot whose producer lost the race against a consumer
+static void cc_abandoned_task(void* ctx) { (void)ctx; }
+#define CC_SLOT_ABANDONED cc_abandoned_task
+
+static struct cc_queue_segment* queue_segment_new(void) {
+    struct cc_queue_segment* seg = calloc(1, sizeof(*seg));
+    if (seg == NULL) {
+        printf("%s: out of memory\n", __func__);
+        abort();
     }
-    // then add all with same lock
-    pthread_mutex_lock(&queue->nq_lock);
+    return seg;
+}
+
+static void queue_init(struct cc_task_queue* queue) {
+    struct cc_queue_segment* seg = queue_segment_new();
+    atomic_store(&queue->head, seg);
+    atomic_store(&queue->tail, seg);
+}
+
+static void free_segments(struct cc_queue_segment* seg) {
+    while (seg != NULL) {
+        struct cc_queue_segment* retired = seg->retired;
+        free(seg);
+        seg = retired;
+    }
+}
+
+// pushes a list of segments linked through their retired field
+static void retire_segments(struct cc_task_queue* queue, struct cc_queue_segment* first) {
+    struct cc_queue_segment* last = first;
+    while (last->retired != NULL) {
+        last = last->retired;
+    }
+    last->retired = atomic_load(&queue->retired);
+    while (!atomic_compare_exchange_weak(&queue->retired, &last->retired, first)) {
+    }
+}
 
-    for (size_t i = 0; i < queue->nthreads; i++) {
-        queue->tasks[queue->tail] = *t;
-        queue->tail = (queue->tail + 1) % CC_THREADPOOL_QUEUE_CAPACITY;
+// no thread is done with the pool once stopped, the segments still linked
+// start at whichever of head and tail is behind
+static void queue_free(struct cc_task_queue* queue) {
+    struct cc_queue_segment* head = atomic_load(&queue->head);
+    struct cc_queue_segment* first = atomic_load(&queue->tail);
+    for (struct cc_queue_segment* seg = first; seg != head; seg = atomic_load(&seg->next)) {
+        if (seg == NULL) {
+            first = head; // head is behind tail
+            break;
+        }
+    }
+    while (first != NULL) {
+        struct cc_queue_segment* next = atomic_load(&first->next);
+        free(first);
+        first = next;
+    }
+    free_segments(atomic_load(&queue->retired));
+    memset(queue, 0, sizeof(*queue));
+}
+
+static void queue_enter(struct cc_task_queue* queue) {
+    atomic_fetch_add(&queue->active, 1);
+}
+
+// the segments retired before the last push or pop in progress left can't
+// be reached by any other, those that started since only see later ones
+static void queue_leave(struct cc_task_queue* queue) {
+    struct cc_queue_segment* retired = NULL;
+    if (atomic_load(&queue->retired) != NULL) {
+        retired = atomic_exchange(&queue->retired, NULL);
+    }
+    if (atomic_fetch_sub(&queue->active, 1) == 1) {
+        free_segments(retired);
+    } else if (retired != NULL) {
+        retire_segments(queue, retired);
+    }
+}
+
+// moves the shared pointer past a full segment, linking in a new one if needed
+static void queue_advance(struct cc_task_queue* queue, _Atomic(struct cc_queue_segment*)* ptr, struct cc_queue_segment* seg) {
+    struct cc_queue_segment* next = atomic_load(&seg->next);
+    if (next == NULL) {
+        struct cc_queue_segment* fresh = queue_segment_new();
+        if (atomic_compare_exchange_strong(&seg->next, &next, fresh)) {
+            next = fresh;
+        } else {
+            free(fresh); // another thread linked one in
+        }
+    }
+    struct cc_queue_segment* expected = seg;
+    if (atomic_compare_exchange_strong(ptr, &expected, next) && atomic_fetch_add(&seg->passed, 1) == 1) {
+        seg->retired = NULL;
+        retire_segments(queue, seg);
+    }
+}
+
+static void queue_push_entered(struct cc_task_queue* queue, struct cc_task t) {
+    for (;;) {
+        struct cc_queue_segment* seg = atomic_load(&queue->tail);
+        size_t i = atomic_fetch_add(&seg->enq_index, 1);
+        if (i >= CC_THREADPOOL_SEGMENT_SIZE) {
+            queue_advance(queue, &queue->tail, seg);
+            continue;
+        }
+        struct cc_task_slot* slot = &seg->slots[i];
+        atomic_store_explicit(&slot->ctx, t.ctx, memory_order_relaxed);
+        atomic_store_explicit(&slot->group, t.group, memory_order_relaxed);
+        cc_task_func empty = NULL;
+        if (atomic_compare_exchange_strong_explicit(&slot->func, &empty, t.func,
+                memory_order_release, memory_order_relaxed)) {
+            return;
+        }
+        // a consumer gave up on this slot, try the next one
     }
-    pthread_mutex_unlock(&queue->nq_lock);
+}
+
+static void queue_push(struct cc_task_queue* queue, struct cc_task t) {
+    queue_enter(queue);
+    queue_push_entered(queue, t);
+    queue_leave(queue);
+}
 
-    for (size_t i = 0; i < queue->nthreads; i++) {
-        sem_post(&queue->filled_slots);
+static bool queue_pop_entered(struct cc_task_queue* queue, struct cc_task* t) {
+    for (;;) {
+        struct cc_queue_segment* seg = atomic_load(&queue->head);
+        size_t deq = atomic_load(&seg->deq_index);
+        size_t enq = atomic_load(&seg->enq_index);
+        if (deq >= enq && atomic_load(&seg->next) == NULL) {
+            return false; // empty, checked without claiming a slot
+        }
+        size_t i = atomic_fetch_add(&seg->deq_index, 1);
+        if (i >= CC_THREADPOOL_SEGMENT_SIZE) {
+            if (atomic_load(&seg->next) == NULL) {
+                return false; // drained and nothing was linked in yet
+            }
+            queue_advance(queue, &queue->head, seg);
+            continue;
+        }
+
+        struct cc_task_slot* slot = &seg->slots[i];
+        cc_task_func func = atomic_load_explicit(&slot->func, memory_order_acquire);
+        if (func == NULL && atomic_load(&seg->enq_index) > i) {
+            // a producer claimed the slot and is about to fill it
+            while ((func = atomic_load_explicit(&slot->func, memory_order_acquire)) == NULL) {
+                sched_yield();
+            }
+        }
+        if (func == NULL && atomic_compare_exchange_strong_explicit(&slot->func, &func, CC_SLOT_ABANDONED,
+                memory_order_acquire, memory_order_acquire)) {
+            continue; // no producer yet, the slot is skipped
+        }
+        if (func == CC_SLOT_ABANDONED) {
+            continue;
+        }
+        t->func = func;
+        t->ctx = atomic_load_explicit(&slot->ctx, memory_order_relaxed);
+        t->group = atomic_load_explicit(&slot->group, memory_order_relaxed);
+        return true;
     }
 }
 
-static struct cc_task dequeue_task(struct cc_threadpool* queue) {
-    sem_wait(&queue->filled_slots);
+static bool queue_pop(struct cc_task_queue* queue, struct cc_task* t) {
+    queue_enter(queue);
+    bool found = queue_pop_entered(queue, t);
+    queue_leave(queue);
+    return found;
+}
 
-    pthread_mutex_lock(&queue->dq_lock);
-    struct cc_task t = queue->tasks[queue->head];
-    queue->head = (queue->head + 1) % CC_THREADPOOL_QUEUE_CAPACITY;
-    pthread_mutex_unlock(&queue->dq_lock);
+static uint64_t next_random(struct cc_worker* w) {
+    // xorshift64
+    w->rng ^= w->rng << 13;
+    w->rng ^= w->rng >> 7;
+    w->rng ^= w->rng << 17;
+    return w->rng;
+}
 
-    sem_post(&queue->empty_slots);
-    return t;
+static bool find_task(struct cc_worker* self, struct cc_task* t) {
+    struct cc_threadpool* pool = self->pool;
+    if (deque_pop(self, t) || queue_pop(&pool->injected, t)) {
+        return true;
+    }
+    // visit every other worker once, starting at a random victim
+    size_t n = pool->nthreads;
+    size_t start = next_random(self) % n;
+    for (size_t i = 0; i < n; ++i) {
+        struct cc_worker* victim = &pool->workers[(start + i) % n];
+        if (victim != self && deque_steal(victim, t)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void task_done(struct cc_threadpool* pool, struct cc_task_group* group) {
+    // the waiter may free the group as soon as its count drops to zero
+    bool group_done = group != NULL && atomic_fetch_sub(&group->pending, 1) == 1;
+    bool pool_done = atomic_fetch_sub(&pool->pending, 1) == 1;
+    if (group_done || pool_done) {
+        pthread_mutex_lock(&pool->done_lock);
+        pthread_cond_broadcast(&pool->done_cond);
+        pthread_mutex_unlock(&pool->done_lock);
+    }
+}
+
+static void run_task(struct cc_threadpool* pool, struct cc_task t) {
+    t.func(t.ctx);
+    task_done(pool, t.group);
 }
 
 static void* worker_thread(void* arg) {
-    struct cc_threadpool* pool = (struct cc_threadpool*)arg;
+    struct cc_worker* self = arg;
+    struct cc_threadpool* pool = self->pool;
+    pthread_setspecific(pool->worker_key, self);
+
+    // thieves only look at the array once something was pushed
+    atomic_store(&self->array, deque_array_new(CC_DEQUE_INITIAL_SIZE));
+
     for (;;) {
-        struct cc_task t = dequeue_task(pool);
-        if (t.func == NULL) {
-            // exit signal
+        // read the epoch before searching so work published
+        // during the search is never slept through
+        unsigned epoch = atomic_load(&pool->epoch);
+
+        struct cc_task t;
+        if (find_task(self, &t)) {
+            run_task(pool, t);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->park_lock);
+        atomic_fetch_add(&pool->sleepers, 1);
+        while (atomic_load(&pool->epoch) == epoch && !atomic_load(&pool->stopping)) {
+            pthread_cond_wait(&pool->park_cond, &pool->park_lock);
+        }
+        atomic_fetch_sub(&pool->sleepers, 1);
+        bool stopping = atomic_load(&pool->stopping);
+        pthread_mutex_unlock(&pool->park_lock);
+
+        // only stopped once everything completed
+        if (stopping) {
             break;
         }
-        t.func(t.ctx);
     }
     return NULL;
 }
@@ -123,127 +527,209 @@ static void* worker_thread(void* arg) {
 int cc_threadpool_init(struct cc_threadpool* pool, size_t nthreads) {
     assert(pool != NULL);
 
-    if (nthreads > CC_THREADPOOL_MAX_THREADS) {
-        printf("error: reached max threads: CC_THREADPOOL_MAX_THREADS(%d) > nthreads(%zu)\n", CC_THREADPOOL_MAX_THREADS, nthreads);
-        printf("       can rebuild with custom define CC_THREADPOOL_MAX_THREADS\n");
-        printf("       to increase limit\n");
+    if (nthreads == 0) {
         return EINVAL;
     }
 
     memset(pool, 0, sizeof*pool);
 
-    sem_init(&pool->empty_slots, 0, CC_THREADPOOL_QUEUE_CAPACITY);
-    sem_init(&pool->filled_slots, 0, 0);
+    pool->workers = calloc(nthreads, sizeof(*pool->workers));
+    if (pool->workers == NULL) {
+        return ENOMEM;
+    }
+    pthread_key_create(&pool->worker_key, NULL);
+    pthread_mutex_init(&pool->park_lock, NULL);
+    pthread_cond_init(&pool->park_cond, NULL);
+    pthread_mutex_init(&pool->done_lock, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    queue_init(&pool->injected);
 
-    pthread_mutex_init(&pool->nq_lock, NULL);
-    pthread_mutex_init(&pool->dq_lock, NULL);
+    for (size_t i = 0; i < nthreads; i++) {
+        struct cc_worker* w = &pool->workers[i];
+        w->pool = pool;
+        w->rng = 0x9e3779b97f4a7c15ull * (i + 1);
+    }
 
-    pool->head = 0;
-    pool->tail = 0;
+    // nthreads must be final before the first worker starts stealing, a
+    // failure to start all of them stops the ones that did start, the
+    // others are victims with nothing to steal until then
     pool->nthreads = nthreads;
-
     for (size_t i = 0; i < nthreads; i++) {
-        pthread_create(&pool->threads[i], NULL, worker_thread, pool);
+        int err = pthread_create(&pool->workers[i].thread, NULL, worker_thread, &pool->workers[i]);
+        if (err != 0) {
+            printf("error: failed to start thread %zu of %zu\n", i + 1, nthreads);
+            cc_threadpool_stop_and_wait(pool);
+            return err;
+        }
+        pool->nstarted = i + 1;
     }
     return 0;
 }
 
-int cc_threadpool_submit(struct cc_threadpool* pool, void* ctx, cc_task_func func) {
+static int submit_task(struct cc_threadpool* pool, struct cc_task t) {
     assert(pool != NULL);
     assert(pool->nthreads > 0);
 
-    if (func == NULL) {
+    if (t.func == NULL) {
         return EINVAL;
     }
-    enqueue_task(pool, &(struct cc_task){
-        .func = func,
-        .ctx = ctx,
-    });
+    if (t.group != NULL) {
+        atomic_fetch_add(&t.group->pending, 1);
+    }
+    atomic_fetch_add(&pool->pending, 1);
+
+    struct cc_worker* self = pthread_getspecific(pool->worker_key);
+    if (self != NULL) {
+        deque_push(self, t);
+    } else {
+        queue_push(&pool->injected, t);
+    }
+    wake_worker(pool);
     return 0;
 }
 
-struct fence_ctx {
-    pthread_cond_t cond;
-    pthread_mutex_t mutex;
-    size_t active_threads;
-    sem_t fences_cleared;
-};
+int cc_threadpool_submit(struct cc_threadpool* pool, void* ctx, cc_task_func func) {
+    return submit_task(pool, (struct cc_task){ .func = func, .ctx = ctx });
+}
 
-static void fenced_wait(void* arg) {
-    struct fence_ctx* ctx = arg;
-    // all threads must block except for the last one,
-    // which will signal all pool threads to continue
-    pthread_mutex_lock(&ctx->mutex);
-    ctx->active_threads--;
+static void run_handle(void* ctx) {
+    struct cc_task_handle* handle = ctx;
+    struct cc_threadpool* pool = handle->pool;
 
-    if (ctx->active_threads == 0) {
-        pthread_cond_broadcast(&ctx->cond);
+    int result = ECANCELED;
+    if (!cc_threadpool_cancelled(pool)) {
+        result = handle->func(handle->ctx);
+    }
+    // the waiter may free the handle as soon as the lock is released
+    pthread_mutex_lock(&pool->done_lock);
+    handle->result = result;
+    atomic_store(&handle->done, true);
+    pthread_cond_broadcast(&pool->done_cond);
+    pthread_mutex_unlock(&pool->done_lock);
+}
 
-    } else {
-        while (ctx->active_threads > 0) {
-            pthread_cond_wait(&ctx->cond, &ctx->mutex);
-        }
+int cc_threadpool_submit_handle(struct cc_threadpool* pool, struct cc_task_handle* handle, void* ctx, cc_task_result_func func) {
+    assert(pool != NULL);
+    assert(handle != NULL);
+
+    if (func == NULL) {
+        return EINVAL;
     }
-    pthread_mutex_unlock(&ctx->mutex);
+    handle->pool = pool;
+    handle->func = func;
+    handle->ctx = ctx;
+    handle->result = 0;
+    atomic_store(&handle->done, false);
+    return cc_threadpool_submit(pool, handle, run_handle);
+}
+
+int cc_task_handle_wait(struct cc_task_handle* handle) {
+    assert(handle != NULL);
+    struct cc_threadpool* pool = handle->pool;
+    assert(pthread_getspecific(pool->worker_key) == NULL);
 
-    // must be done with ctx after clearing fence,
-    // the main thread will destroy and free it
-    sem_post(&ctx->fences_cleared);
+    pthread_mutex_lock(&pool->done_lock);
+    while (!atomic_load(&handle->done)) {
+        pthread_cond_wait(&pool->done_cond, &pool->done_lock);
+    }
+    int result = handle->result;
+    pthread_mutex_unlock(&pool->done_lock);
+    return result;
 }
 
-void cc_threadpool_fenced_wait(struct cc_threadpool* pool) {
+bool cc_threadpool_cancel(struct cc_threadpool* pool) {
     assert(pool != NULL);
+    return !atomic_exchange(&pool->cancelled, true);
+}
 
-    // each fence added needs its own context
-    struct fence_ctx *ctx = calloc(1, sizeof(*ctx));
+bool cc_threadpool_cancelled(struct cc_threadpool* pool) {
+    assert(pool != NULL);
+    return atomic_load_explicit(&pool->cancelled, memory_order_relaxed);
+}
 
-    pthread_mutex_init(&ctx->mutex, NULL);
-    pthread_cond_init(&ctx->cond, NULL);
+void cc_threadpool_fenced_wait(struct cc_threadpool* pool) {
+    assert(pool != NULL);
+    assert(pthread_getspecific(pool->worker_key) == NULL);
 
-    sem_init(&ctx->fences_cleared, 0, 0);
-    ctx->active_threads = pool->nthreads;
+    pthread_mutex_lock(&pool->done_lock);
+    while (atomic_load(&pool->pending) > 0) {
+        pthread_cond_wait(&pool->done_cond, &pool->done_lock);
+    }
+    pthread_mutex_unlock(&pool->done_lock);
+}
 
-    // Submit a fence task for each pool thread, each fence task
-    // will block a thread from proceeding until all threads
-    // are blocked, then all threads are signaled to continue
-    enqueue_fence_tasks(pool, &(struct cc_task){
-        .func = fenced_wait,
-        .ctx = ctx,
-    });
+void cc_task_group_init(struct cc_task_group* group, struct cc_threadpool* pool) {
+    assert(group != NULL);
+    assert(pool != NULL);
+    group->pool = pool;
+    atomic_store(&group->pending, 0);
+}
+
+int cc_task_group_submit(struct cc_task_group* group, void* ctx, cc_task_func func) {
+    assert(group != NULL);
+    return submit_task(group->pool, (struct cc_task){ .func = func, .ctx = ctx, .group = group });
+}
 
-    // wait for all fences to clear
-    for (size_t i = 0; i < pool->nthreads; ++i) {
-        sem_wait(&ctx->fences_cleared);
+void cc_task_group_wait(struct cc_task_group* group) {
+    assert(group != NULL);
+    struct cc_threadpool* pool = group->pool;
+
+    // a worker must not block, it would take a thread away from
+    // the very tasks it waits on, so it runs them (or others) instead
+    struct cc_worker* self = pthread_getspecific(pool->worker_key);
+    if (self != NULL) {
+        while (atomic_load(&group->pending) > 0) {
+            struct cc_task t;
+            if (find_task(self, &t)) {
+                run_task(pool, t);
+            } else {
+                sched_yield();
+            }
+        }
+        return;
     }
 
-    pthread_mutex_destroy(&ctx->mutex);
-    sem_destroy(&ctx->fences_cleared);
-    pthread_cond_destroy(&ctx->cond);
-    free(ctx);
+    pthread_mutex_lock(&pool->done_lock);
+    while (atomic_load(&group->pending) > 0) {
+        pthread_cond_wait(&pool->done_cond, &pool->done_lock);
+    }
+    pthread_mutex_unlock(&pool->done_lock);
 }
 
 void cc_threadpool_stop_and_wait(struct cc_threadpool* pool) {
     assert(pool != NULL);
 
-    // Submit "stop" tasks for each worker thread
-    for (size_t i = 0; i < pool->nthreads; i++) {
-        enqueue_task(pool, &(struct cc_task){
-            .func = NULL,
-            .ctx = NULL,
-        });
-    }
+    // finish all queued tasks, then release the parked workers
+    cc_threadpool_fenced_wait(pool);
 
-    // wait
-    for (size_t i = 0; i < pool->nthreads; i++) {
-        pthread_join(pool->threads[i], NULL);
+    pthread_mutex_lock(&pool->park_lock);
+    atomic_store(&pool->stopping, true);
+    pthread_cond_broadcast(&pool->park_cond);
+    pthread_mutex_unlock(&pool->park_lock);
+
+    for (size_t i = 0; i < pool->nstarted; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
     }
 
     // clean up
-    sem_destroy(&pool->empty_slots);
-    sem_destroy(&pool->filled_slots);
-    pthread_mutex_destroy(&pool->nq_lock);
-    pthread_mutex_destroy(&pool->dq_lock);
+    for (size_t i = 0; i < pool->nthreads; i++) {
+        struct cc_deque_array* array = atomic_load(&pool->workers[i].array);
+        while (array != NULL) {
+            struct cc_deque_array* retired = array->retired;
+            free(array);
+            array = retired;
+        }
+    }
+    queue_free(&pool->injected);
+    free(pool->workers);
+    pool->workers = NULL;
+    pthread_key_delete(pool->worker_key);
+    pthread_mutex_destroy(&pool->park_lock);
+    pthread_cond_destroy(&pool->park_cond);
+    pthread_mutex_destroy(&pool->done_lock);
+    pthread_cond_destroy(&pool->done_cond);
     pool->nthreads = 0;
+    pool->nstarted = 0;
 }
 
 #endif // CC_THREADPOOL_IMPLEMENTATION
@@ -0,0 +1,88 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2025 Josh Simonot
+ */
+
+// disable logging for tests
+#define CC_LOGF(...)
+
+#define CC_FILES_IMPLEMENTATION
+#include "cc_files.h"
+
+#include "cc_test.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int write_test_file(const char *path, const char *data, size_t len) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        return -1;
+    }
+    size_t written = fwrite(data, 1, len, file);
+    fclose(file);
+    return written == len ? 0 : -1;
+}
+
+static int check_mapping(const char *path, size_t size) {
+    char *data = malloc(size + 1);
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = 'a' + (i % 26);
+    }
+    CHKEQ_INT(write_test_file(path, data, size), 0);
+
+    ccstrview view;
+    CHKEQ_INT(ccfs_map_readonly(path, &view), 0);
+    CHKEQ_INT(view.len, (int)size);
+    CHKEQ_INT(memcmp(view.cstr, data, size), 0);
+
+    // only files below the threshold are copied onto the heap
+    CHKEQ_INT(!!(view.flags & CCSTR_FLAG_HEAP), size < CCFS_MAP_THRESHOLD);
+
+    ccfs_unmap(&view);
+    CHKEQ_PTR(view.cstr, NULL);
+
+    remove(path);
+    free(data);
+    return 0;
+}
+
+int test_map_small_file(void) {
+    return check_mapping("test_cc_files_small.tmp", 100);
+}
+
+int test_map_large_file(void) {
+    return check_mapping("test_cc_files_large.tmp", 3 * CCFS_MAP_THRESHOLD + 7);
+}
+
+int test_map_empty_file(void) {
+    return check_mapping("test_cc_files_empty.tmp", 0);
+}
+
+int test_map_missing_file(void) {
+    ccstrview view;
+    CHKEQ_INT(ccfs_map_readonly("test_cc_files_missing.tmp", &view), ENOENT);
+    CHKEQ_PTR(view.cstr, NULL);
+    CHKEQ_INT(view.len, 0);
+
+    // unmapping a failed mapping is harmless
+    ccfs_unmap(&view);
+    return 0;
+}
+
+int main(void) {
+    int err = 0;
+
+    err |= test_map_small_file();
+    err |= test_map_large_file();
+    err |= test_map_empty_file();
+    err |= test_map_missing_file();
+
+    printf("[%s] test cc_files\n", err? "FAILED": "PASSED");
+    return 0;
+}
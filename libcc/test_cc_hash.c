@@ -0,0 +1,94 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2025 Josh Simonot
+ */
+
+#define CC_HASH_IMPLEMENTATION
+#include "cc_hash.h"
+
+#include "cc_test.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+static int chkeq_u64(struct cctest_ctx ctx, const char *gotstr, uint64_t got, uint64_t exp) {
+    if (got != exp) {
+        cctest_print_context(ctx);
+        printf(" > GOT %s = 0x%016" PRIx64 "\n", gotstr, got);
+        printf(" > EXP 0x%016" PRIx64 "\n", exp);
+        return -1;
+    }
+    return 0;
+}
+
+#define CHKEQ_U64(got, exp) \
+if (chkeq_u64(CCTEST_MAKE_CTX(), #got, got, exp) == -1) {return -1;}
+
+static const char *spam = "Nobody inspects the spammish repetition";
+
+int test_known_vectors(void) {
+    CHKEQ_U64(cc_hash64("", 0, 0), 0xEF46DB3751D8E999ULL);
+    CHKEQ_U64(cc_hash64("a", 1, 0), 0xD24EC4F1A98C6E5BULL);
+    CHKEQ_U64(cc_hash64("abc", 3, 0), 0x44BC2CF5AD770999ULL);
+    CHKEQ_U64(cc_hash64(spam, strlen(spam), 0), 0xFBCEA83C8A378BF1ULL);
+
+    CHKEQ_U64(cc_hash64("", 0, 1), 0xD5AFBA1336A3BE4BULL);
+    CHKEQ_U64(cc_hash64(spam, strlen(spam), 1), 0x43F425448D954DB6ULL);
+    return 0;
+}
+
+int test_long_input(void) {
+    uint8_t data[768];
+    for (size_t i = 0; i < sizeof data; ++i) {
+        data[i] = (uint8_t)i;
+    }
+    CHKEQ_U64(cc_hash64(data, sizeof data, 0), 0x8E03C838C596036FULL);
+    CHKEQ_U64(cc_hash64(data, sizeof data, 1), 0xA80257374B99ADE3ULL);
+    return 0;
+}
+
+// every way of splitting the input must give the one-shot digest
+int test_streaming(void) {
+    uint8_t data[768];
+    for (size_t i = 0; i < sizeof data; ++i) {
+        data[i] = (uint8_t)i;
+    }
+    size_t lengths[] = {0, 1, 3, 31, 32, 33, 64, 100, sizeof data};
+
+    for (size_t l = 0; l < sizeof lengths / sizeof *lengths; ++l) {
+        size_t len = lengths[l];
+        uint64_t expected = cc_hash64(data, len, 7);
+
+        for (size_t split = 0; split <= len; split += 1 + split / 4) {
+            struct cc_hash64_state state;
+            cc_hash64_reset(&state, 7);
+            cc_hash64_update(&state, data, split);
+            cc_hash64_update(&state, data + split, len - split);
+            CHKEQ_U64(cc_hash64_digest(&state), expected);
+        }
+
+        // byte at a time
+        struct cc_hash64_state state;
+        cc_hash64_reset(&state, 7);
+        for (size_t i = 0; i < len; ++i) {
+            cc_hash64_update(&state, data + i, 1);
+        }
+        CHKEQ_U64(cc_hash64_digest(&state), expected);
+    }
+    return 0;
+}
+
+int main(void) {
+    int err = 0;
+
+    err |= test_known_vectors();
+    err |= test_long_input();
+    err |= test_streaming();
+
+    printf("[%s] test cc_hash\n", err? "FAILED": "PASSED");
+    return 0;
+}
@@ -0,0 +1,179 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2025 Josh Simonot
+ */
+
+#define CC_TASKGRAPH_IMPLEMENTATION
+#include "cc_taskgraph.h"
+
+#define CC_THREADPOOL_IMPLEMENTATION
+#include "cc_threadpool.h"
+
+#include "cc_test.h"
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+
+// records the order in which nodes ran
+struct order_ctx {
+    atomic_int next;
+    int ran_at[8];
+};
+
+struct order_task {
+    struct order_ctx* order;
+    int id;
+};
+
+static void test_task_record(void* ctx) {
+    struct order_task* task = ctx;
+    task->order->ran_at[task->id] = atomic_fetch_add(&task->order->next, 1);
+}
+
+int test_diamond(void) {
+    struct cc_threadpool pool;
+    cc_threadpool_init(&pool, 4);
+
+    struct cc_taskgraph graph;
+    cc_taskgraph_init(&graph, &pool);
+
+    // 0 -> 1 -> 3
+    // 0 -> 2 -> 3
+    struct order_ctx order = {0};
+    struct order_task tasks[4];
+    struct cc_task_node* nodes[4];
+    for (int i = 0; i < 4; ++i) {
+        tasks[i] = (struct order_task){ .order = &order, .id = i };
+        nodes[i] = cc_taskgraph_add(&graph, &tasks[i], test_task_record);
+    }
+    cc_taskgraph_depend(&graph, nodes[1], nodes[0]);
+    cc_taskgraph_depend(&graph, nodes[2], nodes[0]);
+    cc_taskgraph_depend(&graph, nodes[3], nodes[1]);
+    cc_taskgraph_depend(&graph, nodes[3], nodes[2]);
+
+    // released in reverse, nothing may run before its dependencies
+    for (int i = 3; i >= 0; --i) {
+        cc_taskgraph_release(&graph, nodes[i]);
+    }
+    cc_taskgraph_wait(&graph);
+
+    CHKEQ_INT(order.next, 4);
+    CHKEQ_INT(order.ran_at[0], 0);
+    CHKEQ_INT(order.ran_at[3], 3);
+
+    // depending on a completed node doesn't hold the new node back
+    struct cc_task_node* late = cc_taskgraph_add(&graph, &(struct order_task){ .order = &order, .id = 4 }, test_task_record);
+    cc_taskgraph_depend(&graph, late, nodes[3]);
+    cc_taskgraph_release(&graph, late);
+    cc_taskgraph_wait(&graph);
+    CHKEQ_INT(order.ran_at[4], 4);
+
+    cc_taskgraph_free(&graph);
+    cc_threadpool_stop_and_wait(&pool);
+    return 0;
+}
+
+struct spawner_ctx {
+    struct cc_taskgraph* graph;
+    struct cc_task_node* after; // waits on the spawner
+    struct order_ctx order;
+    struct order_task child;
+    struct order_task final;
+};
+
+static void test_task_spawner(void* ctx) {
+    struct spawner_ctx* spawner = ctx;
+
+    // the final node is already released, but still waits
+    // on this node, so it can be given another dependency
+    struct cc_task_node* child = cc_taskgraph_add(spawner->graph, &spawner->child, test_task_record);
+    cc_taskgraph_depend(spawner->graph, spawner->after, child);
+    cc_taskgraph_release(spawner->graph, child);
+}
+
+int test_add_while_running(void) {
+    struct cc_threadpool pool;
+    cc_threadpool_init(&pool, 2);
+
+    struct cc_taskgraph graph;
+    cc_taskgraph_init(&graph, &pool);
+
+    struct spawner_ctx spawner = { .graph = &graph };
+    spawner.child = (struct order_task){ .order = &spawner.order, .id = 0 };
+    spawner.final = (struct order_task){ .order = &spawner.order, .id = 1 };
+
+    struct cc_task_node* first = cc_taskgraph_add(&graph, &spawner, test_task_spawner);
+    spawner.after = cc_taskgraph_add(&graph, &spawner.final, test_task_record);
+    cc_taskgraph_depend(&graph, spawner.after, first);
+    cc_taskgraph_release(&graph, spawner.after);
+    cc_taskgraph_release(&graph, first);
+
+    // the wait also covers the node added while running
+    cc_taskgraph_wait(&graph);
+    CHKEQ_INT(spawner.order.next, 2);
+    CHKEQ_INT(spawner.order.ran_at[0], 0);
+    CHKEQ_INT(spawner.order.ran_at[1], 1);
+
+    cc_taskgraph_free(&graph);
+    cc_threadpool_stop_and_wait(&pool);
+    return 0;
+}
+
+static void test_task_block(void* ctx) {
+    atomic_bool* gate = ctx;
+    while (!atomic_load(gate)) {
+        sched_yield();
+    }
+}
+
+static void test_task_set(void* ctx) {
+    atomic_store((atomic_bool*)ctx, true);
+}
+
+int test_no_fence(void) {
+    struct cc_threadpool pool;
+    cc_threadpool_init(&pool, 2);
+
+    struct cc_taskgraph graph;
+    cc_taskgraph_init(&graph, &pool);
+
+    // a slow node must not hold back nodes that don't depend on it:
+    // b depends on a only, and runs while slow is still blocked
+    atomic_bool gate = false;
+    atomic_bool ran = false;
+    struct cc_task_node* slow = cc_taskgraph_add(&graph, &gate, test_task_block);
+    struct cc_task_node* a = cc_taskgraph_add(&graph, NULL, NULL);
+    struct cc_task_node* b = cc_taskgraph_add(&graph, &ran, test_task_set);
+    cc_taskgraph_depend(&graph, b, a);
+    cc_taskgraph_release(&graph, slow);
+    cc_taskgraph_release(&graph, b);
+    cc_taskgraph_release(&graph, a);
+
+    time_t start = time(NULL);
+    while (!atomic_load(&ran) && time(NULL) - start < 5) {
+        sched_yield();
+    }
+    CHKEQ_INT(atomic_load(&ran), true);
+
+    atomic_store(&gate, true);
+    cc_taskgraph_wait(&graph);
+
+    cc_taskgraph_free(&graph);
+    cc_threadpool_stop_and_wait(&pool);
+    return 0;
+}
+
+int main(void) {
+    int err = 0;
+
+    err |= test_diamond();
+    err |= test_add_while_running();
+    err |= test_no_fence();
+
+    printf("[%s] test cc_taskgraph\n", err? "FAILED": "PASSED");
+    return 0;
+}
@@ -6,7 +6,8 @@
  * Copyright (c) 2025 Josh Simonot
  */
 
-#define CC_THREADPOOL_MAX_THREADS 8
+// small segments so the tests cross segment boundaries
+#define CC_THREADPOOL_SEGMENT_SIZE 8
 #define CC_THREADPOOL_IMPLEMENTATION
 #include "cc_threadpool.h"
 
@@ -22,15 +23,17 @@ static void test_task_inc(void* ctx) {
 int test_init(void) {
     struct cc_threadpool pool;
 
-    // cannot exceed max thread count
-    CHKEQ_INT(cc_threadpool_init(&pool, 420), EINVAL);
+    // needs at least one thread
+    CHKEQ_INT(cc_threadpool_init(&pool, 0), EINVAL);
 
     // happy path
     CHKEQ_INT(cc_threadpool_init(&pool, 8), 0);
     CHKEQ_INT(pool.nthreads, 8);
-    CHKEQ_INT(pool.head, 0);
-    CHKEQ_INT(pool.tail, 0);
+    cc_threadpool_stop_and_wait(&pool);
 
+    // thread count is only limited by the system
+    CHKEQ_INT(cc_threadpool_init(&pool, 96), 0);
+    CHKEQ_INT(pool.nthreads, 96);
     cc_threadpool_stop_and_wait(&pool);
     return 0;
 }
@@ -93,12 +96,247 @@ int test_fence(void) {
     return 0;
 }
 
+static void test_task_block(void* ctx) {
+    atomic_bool* gate = ctx;
+    while (!atomic_load(gate)) {
+        sched_yield();
+    }
+}
+
+int test_unbounded_queue(void) {
+    struct cc_threadpool pool;
+    cc_threadpool_init(&pool, 1);
+
+    // with the only worker blocked, submitting far more tasks
+    // than a segment holds must not block the submitter
+    atomic_bool gate = false;
+    _Atomic int val = 0;
+    CHKEQ_INT(cc_threadpool_submit(&pool, &gate, test_task_block), 0);
+    for (int i = 0; i < 1000; ++i) {
+        CHKEQ_INT(cc_threadpool_submit(&pool, &val, test_task_inc), 0);
+    }
+    CHKEQ_INT(val, 0);
+
+    atomic_store(&gate, true);
+    cc_threadpool_fenced_wait(&pool);
+    CHKEQ_INT(val, 1000);
+
+    cc_threadpool_stop_and_wait(&pool);
+    return 0;
+}
+
+// segments still allocated, linked from head or waiting on the retired list
+static size_t count_segments(struct cc_task_queue* queue) {
+    size_t count = 0;
+    for (struct cc_queue_segment* seg = atomic_load(&queue->head); seg != NULL; seg = atomic_load(&seg->next)) {
+        count++;
+    }
+    for (struct cc_queue_segment* seg = atomic_load(&queue->retired); seg != NULL; seg = seg->retired) {
+        count++;
+    }
+    return count;
+}
+
+int test_queue_reclaims_segments(void) {
+    struct cc_threadpool pool;
+    cc_threadpool_init(&pool, 4);
+
+    // submitted from outside the pool, the tasks fill over a thousand
+    // segments, which are freed once the workers moved past them
+    _Atomic int val = 0;
+    for (int i = 0; i < 10000; ++i) {
+        CHKEQ_INT(cc_threadpool_submit(&pool, &val, test_task_inc), 0);
+    }
+    cc_threadpool_fenced_wait(&pool);
+    CHKEQ_INT(val, 10000);
+
+    // one more round trip through the queue once it's quiet
+    CHKEQ_INT(cc_threadpool_submit(&pool, &val, test_task_inc), 0);
+    cc_threadpool_fenced_wait(&pool);
+    CHKEQ_INT(count_segments(&pool.injected) <= 4, 1);
+
+    cc_threadpool_stop_and_wait(&pool);
+    return 0;
+}
+
+struct spawn_ctx {
+    struct cc_threadpool* pool;
+    _Atomic int count;
+};
+
+struct spawn_task {
+    struct spawn_ctx* shared;
+    int depth;
+};
+
+static struct spawn_task spawn_tasks[1 << 10];
+
+// each task spawns two children from inside the pool,
+// node i of the implicit binary tree lives at spawn_tasks[i]
+static void test_task_spawn(void* ctx) {
+    struct spawn_task* task = ctx;
+    atomic_fetch_add(&task->shared->count, 1);
+
+    size_t i = task - spawn_tasks;
+    for (size_t child = 2*i + 1; child <= 2*i + 2; ++child) {
+        if (child < sizeof(spawn_tasks)/sizeof(spawn_tasks[0])) {
+            spawn_tasks[child].shared = task->shared;
+            cc_threadpool_submit(task->shared->pool, &spawn_tasks[child], test_task_spawn);
+        }
+    }
+}
+
+int test_nested_submit(void) {
+    struct cc_threadpool pool;
+    cc_threadpool_init(&pool, 4);
+
+    struct spawn_ctx shared = { .pool = &pool };
+    spawn_tasks[0].shared = &shared;
+
+    // the fence also waits for tasks submitted by tasks
+    CHKEQ_INT(cc_threadpool_submit(&pool, &spawn_tasks[0], test_task_spawn), 0);
+    cc_threadpool_fenced_wait(&pool);
+    CHKEQ_INT(shared.count, 1 << 10);
+
+    cc_threadpool_stop_and_wait(&pool);
+    return 0;
+}
+
+static int test_task_square(void* ctx) {
+    int* val = ctx;
+    return *val * *val;
+}
+
+int test_handle(void) {
+    struct cc_threadpool pool;
+    cc_threadpool_init(&pool, 4);
+
+    struct cc_task_handle handle;
+    CHKEQ_INT(cc_threadpool_submit_handle(&pool, &handle, NULL, NULL), EINVAL);
+
+    // each handle carries the result of its own task
+    int vals[16];
+    struct cc_task_handle handles[16];
+    for (int i = 0; i < 16; ++i) {
+        vals[i] = i;
+        CHKEQ_INT(cc_threadpool_submit_handle(&pool, &handles[i], &vals[i], test_task_square), 0);
+    }
+    for (int i = 0; i < 16; ++i) {
+        CHKEQ_INT(cc_task_handle_wait(&handles[i]), i * i);
+    }
+
+    cc_threadpool_stop_and_wait(&pool);
+    return 0;
+}
+
+int test_cancel(void) {
+    struct cc_threadpool pool;
+    cc_threadpool_init(&pool, 1);
+    CHKEQ_INT(cc_threadpool_cancelled(&pool), false);
+
+    // queue up tasks behind a blocked worker, then cancel
+    atomic_bool gate = false;
+    int val = 3;
+    struct cc_task_handle handles[8];
+    CHKEQ_INT(cc_threadpool_submit(&pool, &gate, test_task_block), 0);
+    for (int i = 0; i < 8; ++i) {
+        CHKEQ_INT(cc_threadpool_submit_handle(&pool, &handles[i], &val, test_task_square), 0);
+    }
+
+    // only the first cancel sets the token
+    CHKEQ_INT(cc_threadpool_cancel(&pool), true);
+    CHKEQ_INT(cc_threadpool_cancel(&pool), false);
+    CHKEQ_INT(cc_threadpool_cancelled(&pool), true);
+    atomic_store(&gate, true);
+
+    // queued tasks with a handle never ran
+    for (int i = 0; i < 8; ++i) {
+        CHKEQ_INT(cc_task_handle_wait(&handles[i]), ECANCELED);
+    }
+
+    // plain tasks still run so they can release what they own
+    _Atomic int count = 0;
+    CHKEQ_INT(cc_threadpool_submit(&pool, &count, test_task_inc), 0);
+    cc_threadpool_stop_and_wait(&pool);
+    CHKEQ_INT(count, 1);
+    return 0;
+}
+
+int test_task_groups(void) {
+    struct cc_threadpool pool;
+    cc_threadpool_init(&pool, 2);
+
+    struct cc_task_group slow, fast;
+    cc_task_group_init(&slow, &pool);
+    cc_task_group_init(&fast, &pool);
+    CHKEQ_INT(cc_task_group_submit(&fast, NULL, NULL), EINVAL);
+
+    // one group is stuck on a task that will not finish until the
+    // other group is done, so waiting on either group alone must not
+    // wait for the other, or for the pool as a whole
+    atomic_bool gate = false;
+    _Atomic int val = 0;
+    CHKEQ_INT(cc_task_group_submit(&slow, &gate, test_task_block), 0);
+    for (int i = 0; i < 100; ++i) {
+        CHKEQ_INT(cc_task_group_submit(&fast, &val, test_task_inc), 0);
+    }
+    cc_task_group_wait(&fast);
+    CHKEQ_INT(val, 100);
+    CHKEQ_INT(atomic_load(&slow.pending), 1);
+
+    atomic_store(&gate, true);
+    cc_task_group_wait(&slow);
+    CHKEQ_INT(atomic_load(&slow.pending), 0);
+
+    cc_threadpool_stop_and_wait(&pool);
+    return 0;
+}
+
+struct group_spawn_ctx {
+    struct cc_threadpool* pool;
+    _Atomic int count;
+};
+
+static void test_task_group_spawn(void* ctx) {
+    struct group_spawn_ctx* shared = ctx;
+
+    // waits from inside a task for a group of its own, with a single
+    // worker this only completes if the waiting worker runs the group
+    struct cc_task_group group;
+    cc_task_group_init(&group, shared->pool);
+    for (int i = 0; i < 10; ++i) {
+        cc_task_group_submit(&group, &shared->count, test_task_inc);
+    }
+    cc_task_group_wait(&group);
+    atomic_fetch_add(&shared->count, 1000);
+}
+
+int test_nested_group_wait(void) {
+    struct cc_threadpool pool;
+    cc_threadpool_init(&pool, 1);
+
+    struct group_spawn_ctx shared = { .pool = &pool };
+    CHKEQ_INT(cc_threadpool_submit(&pool, &shared, test_task_group_spawn), 0);
+    cc_threadpool_fenced_wait(&pool);
+    CHKEQ_INT(shared.count, 1010);
+
+    cc_threadpool_stop_and_wait(&pool);
+    return 0;
+}
+
 int main(void) {
     int err = 0;
     
     err |= test_init();
     err |= test_submit();
     err |= test_fence();
+    err |= test_unbounded_queue();
+    err |= test_queue_reclaims_segments();
+    err |= test_nested_submit();
+    err |= test_handle();
+    err |= test_cancel();
+    err |= test_task_groups();
+    err |= test_nested_group_wait();
 
     printf("[%s] test cc_threadpool\n", err? "FAILED": "PASSED");
     return 0;
@@ -48,6 +48,8 @@ static struct build_opts g_default_bopts = {
     .link = CCSTR_LITERAL("$(CC) $(LDFLAGS) [OBJS] -L[LIBPATHS] $(LIBS) -o [BINPATH]"),
     .link_static = CCSTR_LITERAL("ar rcs [BINPATH].a [OBJS]"),
     .link_shared = CCSTR_LITERAL("$(CC) -shared -fPIC $(LDFLAGS) [OBJS] -L[LIBPATHS] $(LIBS) -o [BINPATH].so"),
+    .depfiles = CCSTR_LITERAL("auto"),
+    .depends = CCSTR_LITERAL(""),
 };
 
 // init new target opts by copying global default opts
@@ -221,6 +223,8 @@ void print_config(const struct build_opts *opts) {
     printopt(release);
     printopt(debug);
     printopt(libs);
+    printopt(depfiles);
+    printopt(depends);
 #undef printopt
     printf("\n");
 }
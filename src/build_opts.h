@@ -37,6 +37,8 @@ struct build_opts {
     ccstr release;
     ccstr debug;
     ccstr libname;
+    ccstr depfiles;
+    ccstr depends;
     time_t lastmodified;
     int so_version;
     enum target_type type;
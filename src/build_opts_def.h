@@ -56,6 +56,8 @@ static const struct option_def build_option_defs[] = {
     {"LIBS",         general_opt_handler,    BOPT_OFFSET(libs),         OPTDEF_CCSTRCPY | OPTDEF_VAR_EXPAND | OPTDEF_APPEND},
     {"RELEASE",      general_opt_handler,    BOPT_OFFSET(release),      OPTDEF_CCSTRCPY | OPTDEF_VAR_EXPAND | OPTDEF_APPEND},
     {"DEBUG",        general_opt_handler,    BOPT_OFFSET(debug),        OPTDEF_CCSTRCPY | OPTDEF_VAR_EXPAND | OPTDEF_APPEND},
+    {"DEPFILES",     general_opt_handler,    BOPT_OFFSET(depfiles),     OPTDEF_CCSTRCPY | OPTDEF_VAR_EXPAND},
+    {"DEPENDS",      general_opt_handler,    BOPT_OFFSET(depends),      OPTDEF_CCSTRCPY | OPTDEF_VAR_EXPAND | OPTDEF_APPEND},
     {"TARGET",       general_opt_handler,    BOPT_OFFSET(target),       OPTDEF_NO_FLAGS},
     {"TYPE",         type_opt_handler,       BOPT_OFFSET(type),         OPTDEF_NO_FLAGS},
     {"SO_VERSION",   so_version_opt_handler, BOPT_OFFSET(so_version),   OPTDEF_NO_FLAGS},
@@ -14,23 +14,36 @@
 #include "libcc/cc_strings.h"
 #include "libcc/cc_trie_map.h"
 #include "libcc/cc_threadpool.h"
+#include "libcc/cc_taskgraph.h"
 
 #include "str_list.h"
+#include "depdb.h"
+#include "include_resolver.h"
+#include "executor.h"
+#include "jobserver.h"
 
 #include <limits.h>
+#include <stdatomic.h>
 #include <stdio.h>
 
 struct cmdopts {
     char* rootdir;
     const char *targets;
-    int jlevel;
+    int jlevel; // 0 if not given
     bool debug;
     bool release;
+    bool stats;
+    bool keep_going; // instead of stopping at the first error
+    bool quiet;      // only print failed commands and the progress
+    int link_jobs;   // links running at once, 0 if not bounded
 };
 
 int cc_clean(struct cmdopts *opts);
 int cc_build(struct cmdopts *opts);
 
+struct build_target;
+struct compile_job;
+
 struct build_state {
     // common state for all targets
     ccstr buildir;
@@ -39,11 +52,75 @@ struct build_state {
     struct cc_trie optsmap;
     struct cc_trie src_files;
     struct cc_threadpool threadpool;
+    struct jobserver jobserver;
+    struct executor executor;
+
+    // every compile and link of every target is a node of the
+    // graph, the build only waits once for all of them
+    struct cc_taskgraph graph;
+    struct build_target **targets;
+    size_t ntargets;
+    atomic_bool failed;
+
+    // compiles are held back until every target is started,
+    // then released longest remaining path first
+    struct compile_job *compiles;
+    size_t ncompiles;
+    size_t compilecap;
+    uint64_t predicted_ns;           // makespan in release order
+    uint64_t predicted_discovery_ns; // makespan had they been released as found
+};
 
-    // target-specific state
-    struct build_opts *target_opts;
+// target-specific state, lives until the target is linked
+struct build_target {
+    struct build_state *state;
+    struct build_opts *opts;
     struct str_list main_files;
     struct str_list obj_files;
+    char *objfiles; // obj_files joined for the link commands, once all are compiled
+    char **objs;    // obj_files sorted by path, once all are compiled
+    struct ccfs_stamp *obj_stamps;
+    size_t nobjs;
+    struct depdb depdb;
+    struct include_resolver resolver;
+    bool depfiles;
+
+    // the command options, split into words once the per-target
+    // placeholders are resolved
+    struct command_template compile_cmd;
+    struct command_template link_cmd;
+    struct command_template link_shared_cmd;
+    struct command_template link_static_cmd;
+
+    struct cc_task_node *objects; // runs once all objs are compiled
+    struct cc_task_node *done;    // runs once everything is linked
+    struct cc_task_node *deps;    // runs once the targets in DEPENDS are done
+
+    bool selected;
+    int visit; // depth first search state while checking DEPENDS
+
+    // a compile or link failed, or a target this one depends on failed
+    atomic_bool failed;
+    // a compile failed, or a target this one depends on failed, so
+    // none of its links can succeed
+    atomic_bool inputs_failed;
+    atomic_bool skip_reported;
+
+    // what the links of the target depend on besides the link commands,
+    // its outputs change the fingerprints of the targets depending on it
+    uint64_t objs_fingerprint; // paths and stamps of the objs
+    uint64_t deps_fingerprint; // outputs of the targets in DEPENDS, transitively
+    _Atomic uint64_t outputs_fingerprint;
+
+    // predicted from the durations recorded by the previous build
+    uint64_t link_ns;    // the longest link, 0 if the links are expected to be skipped
+    uint64_t tail_ns;    // from the objs to the end of the last link waiting on them
+    uint64_t objects_ns; // when the last obj is compiled
+    uint64_t done_ns;    // when the target is linked
+    bool objs_changed;   // some obj is expected to be compiled
+    bool relink;         // some link is expected to run
+    bool relink_predicted;
+    bool predicted;
 };
 
 static inline
@@ -72,8 +149,10 @@ int set_root_and_build_paths(struct build_state *state) {
     // all paths should be relative to project root (?)
     ccfs_chdir(state->rootdir.cstr);
 
-    printf("rootdir='%s'\n", state->rootdir.cstr);
-    printf("buildir='%s'\n", state->buildir.cstr);
+    if (!state->cmdopts.quiet) {
+        printf("rootdir='%s'\n", state->rootdir.cstr);
+        printf("buildir='%s'\n", state->buildir.cstr);
+    }
     return 0;
 }
 
@@ -13,6 +13,7 @@
 #include "build_opts.h"
 
 #include <stdio.h>
+#include <string.h>
 
 // Ensures each path in a space-separated path list has the specified prefix.
 // exmaple: include paths with -I prefix, lib paths with -L prefix
@@ -55,43 +56,574 @@ static void resolve_compile_cmd(ccstr *cmd, struct cmdopts *cmdopts, struct buil
     ccstr_replace(cmd, ccsv_raw("-I[INCPATHS]"), ccsv(&opts->incpaths));
 }
 
+// compiler generated dependency files are used by default with
+// gcc and clang, which both understand -MMD -MF
+static bool use_depfiles(struct build_opts *opts) {
+    ccstrview mode = ccsv(&opts->depfiles);
+    if (ccstrcasecmp(mode, ccsv_raw("yes")) == 0 || ccstrcasecmp(mode, ccsv_raw("on")) == 0
+        || ccstrcasecmp(mode, ccsv_raw("true")) == 0) {
+        return true;
+    }
+    if (ccstrcasecmp(mode, ccsv_raw("auto")) == 0) {
+        ccstrview cc = ccsv(&opts->cc);
+        return ccstrstr(cc, ccsv_raw("gcc")) != -1
+            || ccstrstr(cc, ccsv_raw("g++")) != -1
+            || ccstrstr(cc, ccsv_raw("clang")) != -1;
+    }
+    // a custom compile command may ask for a depfile explicitly
+    return ccstrstr(ccsv(&opts->compile), ccsv_raw("[DEPPATH]")) != -1;
+}
+
 // fill in the per-target predefined template placeholders for the link command
 static void resolve_link_cmd(ccstr *cmd, struct cmdopts *cmdopts, struct build_opts *opts) {
     (void)cmdopts;
     ccstr_replace(cmd, ccsv_raw("-L[LIBPATHS]"), ccsv(&opts->libpaths));
 }
 
+// a compile waiting to be released
+struct compile_job {
+    struct cc_task_node *node;
+    struct build_target *target;
+    uint64_t predicted_ns;
+    uint64_t priority_ns; // predicted compile plus the tail of its target
+    size_t order;         // discovery order
+};
+
+#define UNKNOWN_DURATION UINT64_MAX
+
+// an up to date obj only costs the check, others are expected to take as
+// long as their last compile, new sources are given the mean duration later
+static uint64_t predict_compile(struct build_target *target, const char *srcpath) {
+    if (!is_source_file(srcpath)) {
+        return 0;
+    }
+    char relpath[PATH_MAX];
+    get_relpath(target, srcpath, relpath, sizeof relpath);
+
+    struct depdb_tu *tu = depdb_find_tu(&target->depdb, relpath);
+    if (tu != NULL && tu->built && !depdb_tu_dirty(&target->depdb, tu) && ccfs_is_regular_file(tu->objpath)) {
+        return 0;
+    }
+    if (tu == NULL || tu->duration_ns == 0) {
+        return UNKNOWN_DURATION;
+    }
+    return tu->duration_ns;
+}
+
 // callback, executed on each source file to initiate a compilation
 static int dispatch_compilation_cb(void *ctx, const char *srcpath) {
-    struct build_state *state = ctx;
+    struct build_target *target = ctx;
+    struct build_state *state = target->state;
+    struct cc_taskgraph *graph = &state->graph;
 
     // TODO: get memory from pool allocator (make per-target arena allocator)
     struct compilation_task_ctx *taskctx = calloc(1, sizeof*taskctx);
 
-    taskctx->state = state;
+    taskctx->target = target;
     ccstrcpy_raw(&taskctx->srcpath, srcpath);
-    return cc_threadpool_submit(&state->threadpool, taskctx, compile_translation_unit_cb);
+
+    struct cc_task_node *node = cc_taskgraph_add(graph, taskctx, compile_translation_unit_cb);
+    taskctx->finish = cc_taskgraph_add(graph, taskctx, finish_translation_unit_cb);
+    cc_taskgraph_depend(graph, target->objects, taskctx->finish);
+
+    if (state->ncompiles == state->compilecap) {
+        state->compilecap = state->compilecap ? 2 * state->compilecap : 64;
+        state->compiles = realloc(state->compiles, state->compilecap * sizeof *state->compiles);
+        if (state->compiles == NULL) {
+            printf("%s: out of memory\n", __func__);
+            abort();
+        }
+    }
+    state->compiles[state->ncompiles] = (struct compile_job) {
+        .node = node,
+        .target = target,
+        .predicted_ns = predict_compile(target, srcpath),
+        .order = state->ncompiles,
+    };
+    if (state->compiles[state->ncompiles].predicted_ns != 0) {
+        target->objs_changed = true;
+    }
+    state->ncompiles++;
+    return 0;
+}
+
+static void print_build_stats(struct build_target *target) {
+    struct include_resolver_stats inc = include_resolver_stats(&target->resolver);
+    printf("STATS: include lookups: %zu cached (%zu for headers outside the project), %zu searched\n",
+           inc.hits, inc.missing_hits, inc.misses);
+    printf("STATS: %zu of %zu recorded files changed, %zu of %zu recorded translation units dirty\n",
+           target->depdb.nchanged, target->depdb.nfiles, target->depdb.ndirty, target->depdb.ntus);
+}
+
+enum link_kind {
+    LINK_EXECUTABLE,
+    LINK_SHARED,
+    LINK_STATIC,
+};
+
+static const char *link_actions[] = {
+    [LINK_EXECUTABLE] = "link",
+    [LINK_SHARED] = "link shared library",
+    [LINK_STATIC] = "link static library",
+};
+
+struct link_task_ctx {
+    struct build_target *target;
+    struct cc_task_node *finish; // runs once the link command exited
+    enum link_kind kind;
+    bool uptodate; // nothing changed since the output was linked
+    bool linked;
+    int ret;
+    uint64_t duration_ns;
+    uint64_t fingerprint;
+    struct ccfs_stamp output;
+    char binpath[PATH_MAX];
+    char outpath[PATH_MAX]; // the file the command writes
+    char main_obj[]; // executables only
+};
+
+// links are skipped once the build is cancelled, and when it keeps going
+// they are skipped for targets with errors, they are bound to fail
+static bool can_link(struct build_target *target) {
+    if (cc_threadpool_cancelled(&target->state->threadpool)) {
+        return false;
+    }
+    if (atomic_load(&target->inputs_failed)) {
+        if (!atomic_exchange(&target->skip_reported, true)) {
+            printf("INFO: not linking target '%s' after errors\n", target->opts->target.cstr);
+        }
+        return false;
+    }
+    return true;
+}
+
+// called by the executor once the linker exited
+static void link_done_cb(void *ctx, int status, uint64_t duration_ns) {
+    struct link_task_ctx *taskctx = ctx;
+    taskctx->linked = true;
+    taskctx->ret = status;
+    taskctx->duration_ns = duration_ns;
+    cc_taskgraph_release(&taskctx->target->state->graph, taskctx->finish);
+}
+
+// task graph node, queues the link on the executor, which bounds how many
+// links run at once, the finish node runs once the linker exited
+static void start_link_cb(void *ctx) {
+    struct link_task_ctx *taskctx = ctx;
+    struct build_target *target = taskctx->target;
+    struct build_state *state = target->state;
+
+    if (!can_link(target)) {
+        cc_taskgraph_release(&state->graph, taskctx->finish);
+        return;
+    }
+
+    struct command command;
+    const char *main_obj = NULL;
+    switch (taskctx->kind) {
+    case LINK_EXECUTABLE:
+        main_obj = taskctx->main_obj;
+        executable_path(target, main_obj, taskctx->binpath, sizeof taskctx->binpath);
+        executable_link_command(target, main_obj, taskctx->binpath, &command);
+        break;
+    case LINK_SHARED:
+        library_path(target, taskctx->binpath, sizeof taskctx->binpath);
+        library_link_command(target, &target->link_shared_cmd, "shared", target->objfiles, taskctx->binpath, &command);
+        break;
+    case LINK_STATIC:
+        library_path(target, taskctx->binpath, sizeof taskctx->binpath);
+        library_link_command(target, &target->link_static_cmd, "static", target->objfiles, taskctx->binpath, &command);
+        break;
+    }
+    bool found = link_output_path(command.line, taskctx->binpath, taskctx->outpath, sizeof taskctx->outpath);
+    taskctx->fingerprint = link_fingerprint(target, main_obj, &command, taskctx->kind == LINK_STATIC);
+
+    struct depdb_link *link = depdb_find_link(&target->depdb, taskctx->outpath);
+    bool unchanged = (link != NULL) && output_unchanged(taskctx->outpath, link);
+    if (unchanged && link->fingerprint == taskctx->fingerprint) {
+        depdb_keep_link(&target->depdb, link);
+        taskctx->uptodate = true;
+        taskctx->output = link->output;
+        command_free(&command);
+        cc_taskgraph_release(&state->graph, taskctx->finish);
+        return;
+    }
+
+    // an archive only gets its changed members replaced, otherwise it
+    // is written from scratch so it drops the members of removed objs
+    if (taskctx->kind == LINK_STATIC && found && is_ar_command(&target->link_static_cmd)) {
+        char *changed = unchanged ? changed_members(target, link) : NULL;
+        if (changed != NULL) {
+            command_free(&command);
+            library_link_command(target, &target->link_static_cmd, "static", changed, taskctx->binpath, &command);
+            free(changed);
+        } else {
+            remove(taskctx->outpath);
+        }
+    }
+    make_parent_dir(taskctx->binpath);
+
+    if (!state->cmdopts.quiet) {
+        static const char *kinds[] = { "exec", "shared", "static" };
+        printf("\nINFO: linking %s '%s'\n", kinds[taskctx->kind], taskctx->binpath);
+    }
+    executor_run_link(&state->executor, &command, taskctx, link_done_cb);
 }
 
-// callback, executed on each build target to initiate a build
-static int build_target_cb(void *ctx, void *data) {
+// task graph node, every executable and library reports its own error,
+// and records its fingerprint once it linked
+static void finish_link_cb(void *ctx) {
+    struct link_task_ctx *taskctx = ctx;
+    struct build_target *target = taskctx->target;
+    if (taskctx->linked) {
+        depdb_set_link_duration(&target->depdb, taskctx->duration_ns);
+        if (taskctx->ret != 0) {
+            build_error(target, link_actions[taskctx->kind], taskctx->binpath);
+        } else {
+            bool archive = (taskctx->kind == LINK_STATIC);
+            ccfs_file_stamp(taskctx->outpath, &taskctx->output);
+            depdb_set_link(&target->depdb, taskctx->outpath, taskctx->fingerprint, &taskctx->output,
+                           archive ? target->objs : NULL, archive ? target->obj_stamps : NULL, archive ? target->nobjs : 0);
+        }
+    }
+    if (taskctx->uptodate || (taskctx->linked && taskctx->ret == 0)) {
+        atomic_fetch_xor(&target->outputs_fingerprint, hash_stamp(0, taskctx->outpath, &taskctx->output));
+    }
+    free(taskctx);
+}
+
+// adds a link that starts once the targets this one depends on are
+// linked, the target is only done once all of its links are
+static void add_link(struct build_target *target, enum link_kind kind, const char *main_obj) {
+    struct cc_taskgraph *graph = &target->state->graph;
+    size_t len = main_obj ? strlen(main_obj) : 0;
+
+    struct link_task_ctx *taskctx = calloc(1, sizeof *taskctx + len + 1);
+    if (taskctx == NULL) {
+        printf("%s: out of memory\n", __func__);
+        abort();
+    }
+    taskctx->target = target;
+    taskctx->kind = kind;
+    if (main_obj != NULL) {
+        memcpy(taskctx->main_obj, main_obj, len + 1);
+    }
+
+    struct cc_task_node *node = cc_taskgraph_add(graph, taskctx, start_link_cb);
+    taskctx->finish = cc_taskgraph_add(graph, taskctx, finish_link_cb);
+    cc_taskgraph_depend(graph, node, target->deps);
+    cc_taskgraph_depend(graph, target->done, taskctx->finish);
+    cc_taskgraph_release(graph, node);
+}
+
+static int add_executable_link_cb(void *ctx, char *main_obj) {
+    add_link(ctx, LINK_EXECUTABLE, main_obj);
+    return 0;
+}
+
+// task graph node, runs once every source of the target was compiled,
+// only then is it known which objs have an entry point
+static void target_objects_cb(void *ctx) {
+    struct build_target *target = ctx;
+    struct build_opts *opts = target->opts;
+
+    if (target->state->cmdopts.stats) {
+        print_build_stats(target);
+    }
+    include_resolver_free(&target->resolver);
+
+    collect_obj_files(target);
+
+    // each executable is linked as soon as this target's objs
+    // are built, while other targets may still be compiling
+    if (opts->type & BIN) {
+        foreach_main_file(target, add_executable_link_cb);
+    }
+
+    // the shared and static libs link concurrently too
+    if (opts->type & SHARED) {
+        add_link(target, LINK_SHARED, NULL);
+    }
+    if (opts->type & STATIC) {
+        add_link(target, LINK_STATIC, NULL);
+    }
+}
+
+// task graph node, runs once the target is linked, the
+// dependency database also records how long the links took
+static void target_done_cb(void *ctx) {
+    struct build_target *target = ctx;
+    depdb_save(&target->depdb);
+    depdb_free(&target->depdb);
+}
+
+// callback, executed on each build target to collect them all
+// before any is started, since targets may depend on each other
+static int collect_target_cb(void *ctx, void *data) {
     struct build_state *state = ctx;
-    struct build_opts *opts = data;
 
-    // a simple string search means a selected target can match  multiple targets if
-    // it shows up as a substring... this was not intentional but maybe a feature
-    // worth keeping?
-    if (state->cmdopts.targets != NULL) {
-        bool target_matches = (ccstrstr(ccsv(&opts->target), ccsv_raw(state->cmdopts.targets)) == 0);
-        if (!target_matches) {
-            return 0;
+    struct build_target *target = calloc(1, sizeof *target);
+    state->targets = realloc(state->targets, (state->ntargets + 1) * sizeof *state->targets);
+    if (target == NULL || state->targets == NULL) {
+        printf("%s: out of memory\n", __func__);
+        abort();
+    }
+    target->state = state;
+    target->opts = data;
+    state->targets[state->ntargets++] = target;
+    return 0;
+}
+
+static struct build_target* find_target(struct build_state *state, ccstrview name) {
+    for (size_t i = 0; i < state->ntargets; ++i) {
+        ccstr *target = &state->targets[i]->opts->target;
+        if (target->len == name.len && memcmp(target->cstr, name.cstr, name.len) == 0) {
+            return state->targets[i];
+        }
+    }
+    return NULL;
+}
+
+// iterates over the targets in DEPENDS, once check_depends passed
+static struct build_target* next_dependency(struct build_state *state, ccstrview *depends) {
+    while (depends->len > 0) {
+        ccstrview name = ccsv_tokenize(depends, ' ');
+        if (name.len > 0) {
+            return find_target(state, name);
         }
     }
-    
-    // setup per target variables
-    state->target_opts = opts;
-    str_list_clear(&state->main_files);
-    str_list_clear(&state->obj_files);
+    return NULL;
+}
+
+enum { UNVISITED = 0, VISITING, VISITED };
+
+// every name in DEPENDS must be a target, and the dependencies must not
+// form a cycle, which would leave the build waiting forever
+static int check_depends(struct build_state *state, struct build_target *target) {
+    if (target->visit == VISITED) {
+        return 0;
+    }
+    if (target->visit == VISITING) {
+        printf("config error: targets depend on each other in a cycle through '%s'\n", target->opts->target.cstr);
+        return -1;
+    }
+    target->visit = VISITING;
+
+    ccstrview sv = ccsv(&target->opts->depends);
+    while (sv.len > 0) {
+        ccstrview name = ccsv_tokenize(&sv, ' ');
+        if (name.len == 0) {
+            continue;
+        }
+        struct build_target *dep = find_target(state, name);
+        if (dep == NULL) {
+            printf("config error: target '%s' depends on unknown target '%.*s'\n",
+                   target->opts->target.cstr, (int)name.len, name.cstr);
+            return -1;
+        }
+        if (check_depends(state, dep) != 0) {
+            return -1;
+        }
+    }
+    target->visit = VISITED;
+    return 0;
+}
+
+// a selected target is built along with everything it depends on
+static void select_target(struct build_state *state, struct build_target *target) {
+    if (target->selected) {
+        return;
+    }
+    target->selected = true;
+
+    ccstrview sv = ccsv(&target->opts->depends);
+    struct build_target *dep;
+    while ((dep = next_dependency(state, &sv)) != NULL) {
+        select_target(state, dep);
+    }
+}
+
+// task graph node, runs once the targets this one depends on are done,
+// a target whose dependencies failed fails along with them, and its
+// links are redone when any of their outputs changed
+static void target_deps_cb(void *ctx) {
+    struct build_target *target = ctx;
+    ccstrview sv = ccsv(&target->opts->depends);
+    struct build_target *dep;
+    uint64_t hash = 0;
+    while ((dep = next_dependency(target->state, &sv)) != NULL) {
+        if (atomic_load(&dep->failed)) {
+            atomic_store(&target->failed, true);
+            atomic_store(&target->inputs_failed, true);
+        }
+        uint64_t outputs = atomic_load(&dep->outputs_fingerprint);
+        hash = cc_hash64(&outputs, sizeof outputs, hash);
+        hash = cc_hash64(&dep->deps_fingerprint, sizeof dep->deps_fingerprint, hash);
+    }
+    target->deps_fingerprint = hash;
+}
+
+// the links of a target wait for the targets it depends on, nothing else
+static void add_target_edges(struct build_state *state, struct build_target *target) {
+    ccstrview sv = ccsv(&target->opts->depends);
+    struct build_target *dep;
+    while ((dep = next_dependency(state, &sv)) != NULL) {
+        cc_taskgraph_depend(&state->graph, target->deps, dep->done);
+    }
+}
+
+// the links of a target are skipped when none of its objs changed and
+// no target it depends on links again, as long as its outputs are still
+// what the previous build linked, which the link commands can't change
+static bool predict_relink(struct build_state *state, struct build_target *target) {
+    if (!target->relink_predicted) {
+        bool relink = target->objs_changed || !depdb_outputs_unchanged(&target->depdb);
+        ccstrview sv = ccsv(&target->opts->depends);
+        struct build_target *dep;
+        while ((dep = next_dependency(state, &sv)) != NULL) {
+            relink = predict_relink(state, dep) || relink;
+        }
+        target->relink = relink;
+        target->link_ns = relink ? target->depdb.recorded_link_ns : 0;
+        target->relink_predicted = true;
+    }
+    return target->relink;
+}
+
+// the path remaining once a target's objs are compiled: its own
+// link, then the links of the targets that depend on it
+static void predict_tails(struct build_state *state) {
+    for (size_t i = 0; i < state->ntargets; ++i) {
+        if (state->targets[i]->selected) {
+            predict_relink(state, state->targets[i]);
+        }
+    }
+    for (size_t i = 0; i < state->ntargets; ++i) {
+        state->targets[i]->tail_ns = state->targets[i]->link_ns;
+    }
+    // relaxed once per level of DEPENDS, which has no cycles
+    for (size_t pass = 0; pass < state->ntargets; ++pass) {
+        bool changed = false;
+        for (size_t i = 0; i < state->ntargets; ++i) {
+            struct build_target *target = state->targets[i];
+            if (!target->selected) {
+                continue;
+            }
+            ccstrview sv = ccsv(&target->opts->depends);
+            struct build_target *dep;
+            while ((dep = next_dependency(state, &sv)) != NULL) {
+                uint64_t tail = dep->link_ns + target->tail_ns;
+                if (tail > dep->tail_ns) {
+                    dep->tail_ns = tail;
+                    changed = true;
+                }
+            }
+        }
+        if (!changed) {
+            break;
+        }
+    }
+}
+
+static uint64_t predict_done(struct build_state *state, struct build_target *target) {
+    if (!target->predicted) {
+        uint64_t start = target->objects_ns;
+        ccstrview sv = ccsv(&target->opts->depends);
+        struct build_target *dep;
+        while ((dep = next_dependency(state, &sv)) != NULL) {
+            uint64_t done = predict_done(state, dep);
+            start = (done > start) ? done : start;
+        }
+        target->done_ns = start + target->link_ns;
+        target->predicted = true;
+    }
+    return target->done_ns;
+}
+
+// the pool picks up released compiles in order, each one going to the
+// first free worker, and each target links once its objs and the
+// targets it depends on are done
+static uint64_t predict_makespan(struct build_state *state) {
+    size_t nworkers = state->cmdopts.jlevel;
+    uint64_t *free_at = calloc(nworkers, sizeof *free_at);
+    if (free_at == NULL) {
+        printf("%s: out of memory\n", __func__);
+        abort();
+    }
+    for (size_t i = 0; i < state->ntargets; ++i) {
+        state->targets[i]->objects_ns = 0;
+        state->targets[i]->predicted = false;
+    }
+    for (size_t i = 0; i < state->ncompiles; ++i) {
+        struct compile_job *job = &state->compiles[i];
+        size_t first = 0;
+        for (size_t w = 1; w < nworkers; ++w) {
+            first = (free_at[w] < free_at[first]) ? w : first;
+        }
+        free_at[first] += job->predicted_ns;
+        if (free_at[first] > job->target->objects_ns) {
+            job->target->objects_ns = free_at[first];
+        }
+    }
+    uint64_t makespan = 0;
+    for (size_t i = 0; i < state->ntargets; ++i) {
+        if (state->targets[i]->selected) {
+            uint64_t done = predict_done(state, state->targets[i]);
+            makespan = (done > makespan) ? done : makespan;
+        }
+    }
+    free(free_at);
+    return makespan;
+}
+
+static int compare_priority(const void *a, const void *b) {
+    const struct compile_job *ja = a;
+    const struct compile_job *jb = b;
+    if (ja->priority_ns != jb->priority_ns) {
+        return (ja->priority_ns > jb->priority_ns) ? -1 : 1;
+    }
+    return (ja->order > jb->order) - (ja->order < jb->order);
+}
+
+// releases the compiles of all targets longest remaining path first, so
+// the slowest compiles and those with long link chains behind them start
+// first instead of becoming the tail of the build
+static void release_compiles(struct build_state *state) {
+    uint64_t total = 0;
+    size_t nknown = 0;
+    for (size_t i = 0; i < state->ncompiles; ++i) {
+        if (state->compiles[i].predicted_ns != UNKNOWN_DURATION) {
+            total += state->compiles[i].predicted_ns;
+            nknown++;
+        }
+    }
+    uint64_t mean = nknown ? total / nknown : 0;
+
+    predict_tails(state);
+    for (size_t i = 0; i < state->ncompiles; ++i) {
+        struct compile_job *job = &state->compiles[i];
+        if (job->predicted_ns == UNKNOWN_DURATION) {
+            job->predicted_ns = mean;
+        }
+        job->priority_ns = job->predicted_ns + job->target->tail_ns;
+    }
+
+    state->predicted_discovery_ns = predict_makespan(state);
+    qsort(state->compiles, state->ncompiles, sizeof *state->compiles, compare_priority);
+    state->predicted_ns = predict_makespan(state);
+
+    for (size_t i = 0; i < state->ncompiles; ++i) {
+        cc_taskgraph_release(&state->graph, state->compiles[i].node);
+    }
+    free(state->compiles);
+    state->compiles = NULL;
+    state->ncompiles = 0;
+    state->compilecap = 0;
+}
+
+// sets up the target and collects its compiles
+static void start_target(struct build_state *state, struct build_target *target) {
+    struct build_opts *opts = target->opts;
 
     // ensures all paths have the correct prefixes
     tidy_pathlist(&opts->incpaths, ccsv_raw("-I"));
@@ -99,28 +631,109 @@ static int build_target_cb(void *ctx, void *data) {
 
     // resolve command template per-target placeholders
     resolve_compile_cmd(&opts->compile, &state->cmdopts, opts);
+
+    target->depfiles = use_depfiles(opts);
+    if (target->depfiles && ccstrstr(ccsv(&opts->compile), ccsv_raw("[DEPPATH]")) == -1) {
+        ccstr_append(&opts->compile, ccsv_raw(" -MMD -MF [DEPPATH]"));
+    }
     resolve_link_cmd(&opts->link, &state->cmdopts, opts);
 
-    printf("\nINFO: building target '%s'\n", opts->target.cstr);
-    
-    // queues up all source files for compilation in threadpool
-    foreach_src_file(state, opts->srcpaths, dispatch_compilation_cb);
-    cc_threadpool_fenced_wait(&state->threadpool);
+    command_template_init(&target->compile_cmd, opts->compile.cstr);
+    command_template_init(&target->link_cmd, opts->link.cstr);
+    command_template_init(&target->link_shared_cmd, opts->link_shared.cstr);
+    command_template_init(&target->link_static_cmd, opts->link_static.cstr);
 
-    // TODO: move linking to threadpool?
-    if (opts->type & BIN) {
-        foreach_main_file(state, link_object_files_cb);
+    // set before any link runs, links of the same target run concurrently
+    if (opts->installdir.len == 0) {
+        ccstr_append(&opts->installdir, CCSTRVIEW_STATIC("/"));
+    }
+    resolve_libname(opts);
+
+    if (!state->cmdopts.quiet) {
+        printf("\nINFO: building target '%s'\n", opts->target.cstr);
     }
 
-    // automatically link libs if there are no main files
-    if (opts->type & (SHARED|STATIC) || state->main_files.count == 0) {
-        link_libs(state);
+    // each target keeps its own dependency database since
+    // targets may compile the same sources differently
+    char depdb_path[PATH_MAX];
+    const char *depdb_name = (opts->target.len > 0) ? opts->target.cstr : "default";
+    snprintf(depdb_path, sizeof depdb_path, "%s/.ccbuild/%s.depdb", state->buildir.cstr, depdb_name);
+    depdb_load(&target->depdb, depdb_path);
+    depdb_mark_dirty(&target->depdb);
+    include_resolver_init(&target->resolver, ccsv(&opts->incpaths));
+
+    // adds all source files as compilations to the graph
+    foreach_src_file(target, opts->srcpaths, dispatch_compilation_cb);
+    cc_taskgraph_release(&state->graph, target->objects);
+}
+
+// builds all selected targets concurrently, compiles start once every
+// target is set up and only the links wait for the targets in DEPENDS
+static int build_targets(struct build_state *state) {
+    foreach_target(state, collect_target_cb);
+
+    for (size_t i = 0; i < state->ntargets; ++i) {
+        if (check_depends(state, state->targets[i]) != 0) {
+            return -1;
+        }
     }
 
-    printf("\n");
+    // a simple string search means a selected target can match  multiple targets if
+    // it shows up as a substring... this was not intentional but maybe a feature
+    // worth keeping?
+    for (size_t i = 0; i < state->ntargets; ++i) {
+        struct build_target *target = state->targets[i];
+        if (state->cmdopts.targets == NULL
+            || ccstrstr(ccsv(&target->opts->target), ccsv_raw(state->cmdopts.targets)) == 0) {
+            select_target(state, target);
+        }
+    }
+
+    // all nodes must exist before the edges between targets are added
+    for (size_t i = 0; i < state->ntargets; ++i) {
+        struct build_target *target = state->targets[i];
+        if (target->selected) {
+            target->objects = cc_taskgraph_add(&state->graph, target, target_objects_cb);
+            target->done = cc_taskgraph_add(&state->graph, target, target_done_cb);
+            target->deps = cc_taskgraph_add(&state->graph, target, target_deps_cb);
+            cc_taskgraph_depend(&state->graph, target->done, target->objects);
+        }
+    }
+    for (size_t i = 0; i < state->ntargets; ++i) {
+        struct build_target *target = state->targets[i];
+        if (target->selected) {
+            add_target_edges(state, target);
+            cc_taskgraph_release(&state->graph, target->deps);
+            cc_taskgraph_release(&state->graph, target->done);
+        }
+    }
+    for (size_t i = 0; i < state->ntargets; ++i) {
+        if (state->targets[i]->selected) {
+            start_target(state, state->targets[i]);
+        }
+    }
+    release_compiles(state);
     return 0;
 }
 
+static void free_targets(struct build_state *state) {
+    for (size_t i = 0; i < state->ntargets; ++i) {
+        str_list_clear(&state->targets[i]->main_files);
+        str_list_clear(&state->targets[i]->obj_files);
+        command_template_free(&state->targets[i]->compile_cmd);
+        command_template_free(&state->targets[i]->link_cmd);
+        command_template_free(&state->targets[i]->link_shared_cmd);
+        command_template_free(&state->targets[i]->link_static_cmd);
+        free(state->targets[i]->objfiles);
+        free(state->targets[i]->objs);
+        free(state->targets[i]->obj_stamps);
+        free(state->targets[i]);
+    }
+    free(state->targets);
+    state->targets = NULL;
+    state->ntargets = 0;
+}
+
 int cc_build(struct cmdopts *cmdopts) {
     struct build_state state = {
         .cmdopts = *cmdopts,
@@ -130,9 +743,46 @@ int cc_build(struct cmdopts *cmdopts) {
 
     state.optsmap = parse_build_opts(state.rootdir);
 
-    cc_threadpool_init(&state.threadpool, state.cmdopts.jlevel);
-    foreach_target(&state, build_target_cb);
+    // nested builds share one job budget, the one of the make
+    // running this build or the one this build serves
+    bool client = jobserver_connect(&state.jobserver) == 0;
+    if (state.cmdopts.jlevel == 0) {
+        state.cmdopts.jlevel = (client && state.jobserver.jobs > 0) ? state.jobserver.jobs : 1;
+    }
+    if (client) {
+        printf("INFO: sharing the jobserver from MAKEFLAGS\n");
+    } else if (jobserver_serve(&state.jobserver, state.cmdopts.jlevel) != 0) {
+        jobserver_local(&state.jobserver, state.cmdopts.jlevel);
+    }
+    executor_init(&state.executor, &state.jobserver, state.cmdopts.quiet, state.cmdopts.link_jobs);
+
+    // -j is the number of commands running at once, not threads
+    int nthreads = executor_threads(&state.executor, state.cmdopts.jlevel);
+    err = cc_threadpool_init(&state.threadpool, nthreads);
+    if (err) {
+        printf("error: failed to start %d build threads: %s\n", nthreads, strerror(err));
+        executor_free(&state.executor);
+        jobserver_free(&state.jobserver);
+        return EXIT_FAILURE;
+    }
+    cc_taskgraph_init(&state.graph, &state.threadpool);
+    uint64_t start = monotonic_ns();
+    err = build_targets(&state);
+    cc_taskgraph_wait(&state.graph);
+    uint64_t actual_ns = monotonic_ns() - start;
+    if (!state.cmdopts.quiet || state.executor.progress) {
+        printf("\n"); // also ends the progress line
+    }
+
+    if (state.cmdopts.stats && !err) {
+        printf("STATS: predicted makespan %.2fs (%.2fs in discovery order), actual %.2fs\n",
+               state.predicted_ns / 1e9, state.predicted_discovery_ns / 1e9, actual_ns / 1e9);
+    }
 
+    cc_taskgraph_free(&state.graph);
+    free_targets(&state);
     cc_threadpool_stop_and_wait(&state.threadpool);
-    return EXIT_SUCCESS;
+    executor_free(&state.executor);
+    jobserver_free(&state.jobserver);
+    return (err || atomic_load(&state.failed)) ? EXIT_FAILURE : EXIT_SUCCESS;
 }
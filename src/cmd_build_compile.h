@@ -12,89 +12,252 @@
 #include "cmd.h"
 #include "cmd_build_helpers.h"
 #include "build_opts.h"
+#include "depdb.h"
+#include "obj_symbols.h"
+#include "source_scan.h"
+
+#include "libcc/cc_hash.h"
 
 struct srcinfo {
     char *path;
-    time_t lastmodified;
+    char *objpath;
+    char *deppath;
+    int64_t lastmodified_ns; // newest input, when there is no record
     bool translation_unit;
     bool main_file;
+    bool recorded; // the database knows which inputs the obj was built from
+    bool stale;    // recorded inputs changed or the last build of the obj failed
+    uint64_t recorded_cmdhash; // compile command of the recorded obj
+    uint64_t cmdhash;          // compile command of this build
+    uint64_t duration_ns;      // wall time of the compile
+    bool compiled;
+};
+
+// headers found while scanning a translation unit
+struct header_list {
+    struct depdb_file **items;
+    size_t count;
+    size_t cap;
 };
 
 // Foreach Include Directive ctx
 struct fid_ctx {
-    struct build_state *state;
-    time_t *lastmodified;
+    struct build_target *target;
+    const char *includer;
+    struct header_list *includes;
 };
 
 struct compilation_task_ctx {
-    struct build_state *state;
+    struct build_target *target;
     ccstr srcpath;
+    struct cc_task_node *finish; // runs once the obj is compiled or found up to date
+
+    // carried over from starting the compile to finishing it
+    char relpath[PATH_MAX];
+    char objpath[PATH_MAX];
+    char deppath[PATH_MAX];
+    struct srcinfo src;
+    struct depdb_tu *tu;
+    bool rescan_main;
+    int ret;
 };
 
+static bool header_list_contains(struct header_list *list, struct depdb_file *header) {
+    for (size_t i = 0; i < list->count; ++i) {
+        if (list->items[i] == header) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void header_list_push(struct header_list *list, struct depdb_file *header) {
+    if (list->count == list->cap) {
+        list->cap = list->cap ? 2*list->cap : 32;
+        list->items = realloc(list->items, list->cap * sizeof *list->items);
+        if (list->items == NULL) {
+            printf("%s: out of memory\n", __func__);
+            abort();
+        }
+    }
+    list->items[list->count++] = header;
+}
+
+// collects the direct includes of a file that exist in the project
 static
-int update_lastmodified_cb(void *ctx, const char *header) {
+int collect_include_cb(void *ctx, const char *header, bool quoted) {
     struct fid_ctx *fidctx = ctx;
-    time_t lastmodified;
+    struct depdb *db = &fidctx->target->depdb;
 
-    // TODO: check all include directories to find header
-    // for now its just checking relative to project root...?
-    struct srcinfo *sinfo = cc_trie_search(&fidctx->state->src_files, CC_TRIE_STR_KEY(header));
-    if (sinfo == NULL) {
-        lastmodified = ccfs_last_modified_time(header);
-    } else {
-        lastmodified = sinfo->lastmodified;
+    char path[PATH_MAX];
+    if (!include_resolve(&fidctx->target->resolver, fidctx->includer, header, quoted, path, sizeof path)) {
+        // not part of the project (system includes), we'll
+        // skip these, assuming they wont change (often)
+        return 0;
     }
-    if (lastmodified == -1) {
-        // printf("header not found: '%s'\n", header);
+    struct depdb_file *hfile = depdb_file(db, path);
+    if (header_list_contains(fidctx->includes, hfile)) {
         return 0;
     }
-    if (lastmodified > *fidctx->lastmodified) {
-        *fidctx->lastmodified = lastmodified;
+    depdb_file_changed(db, hfile);
+
+    if (hfile->current.mtime_ns == -1) {
+        return 0;
     }
-    // recurse to get all includes...
-    foreach_include_directive(ctx, header, update_lastmodified_cb);
+    header_list_push(fidctx->includes, hfile);
     return 0;
 }
 
-static int compile_source(struct build_state *state, struct srcinfo *src) {
-    assert(state != NULL);
-    assert(src != NULL);
+// reads the header's include directives, at most once per build
+// no matter how many translation units include it
+static void scan_header(struct build_target *target, struct depdb_file *header) {
+    struct depdb *db = &target->depdb;
+    if (!depdb_claim_scan(db, header)) {
+        return;
+    }
+    struct header_list includes = {0};
+    struct fid_ctx fidctx = {
+        .target = target,
+        .includer = header->path,
+        .includes = &includes,
+    };
+    scan_source_file(header->path, &fidctx, collect_include_cb, NULL);
+    depdb_set_includes(db, header, includes.items, includes.count);
+    free(includes.items);
+}
+
+// collects the transitive includes of a translation unit found
+// by scanning the sources for include directives, the entry point
+// is detected in the same pass over the source if requested
+static void scan_tu_includes(struct build_target *target, const char *srcpath, struct header_list *out, bool *entry_point) {
+    struct depdb *db = &target->depdb;
+
+    struct header_list includes = {0};
+    struct fid_ctx fidctx = {
+        .target = target,
+        .includer = srcpath,
+        .includes = &includes,
+    };
+    scan_source_file(srcpath, &fidctx, collect_include_cb, entry_point);
+
+    // scan the headers the memo has not seen yet
+    struct depdb_closure closure = {0};
+    while (depdb_header_closure(db, includes.items, includes.count, &closure) > 0) {
+        for (size_t i = 0; i < closure.npending; ++i) {
+            scan_header(target, closure.pending[i]);
+        }
+    }
+    for (size_t i = 0; i < closure.count; ++i) {
+        header_list_push(out, closure.headers[i]);
+    }
+    depdb_closure_free(&closure);
+    free(includes.items);
+}
+
+struct depfile_ctx {
+    struct build_target *target;
+    const char *srcpath;
+    struct header_list *headers;
+};
+
+static
+int collect_prerequisite_cb(void *ctx, const char *prereq) {
+    struct depfile_ctx *dctx = ctx;
+    struct depdb *db = &dctx->target->depdb;
 
-    if (!src->translation_unit) {
+    char path[PATH_MAX];
+    if (cwk_path_normalize(prereq, path, sizeof path) >= sizeof path) {
+        return 0;
+    }
+    if (strcmp(path, dctx->srcpath) == 0) {
+        return 0;
+    }
+    struct depdb_file *hfile = depdb_file(db, path);
+    if (header_list_contains(dctx->headers, hfile)) {
         return 0;
     }
+    depdb_file_changed(db, hfile);
+    if (hfile->current.mtime_ns != -1) {
+        header_list_push(dctx->headers, hfile);
+    }
+    return 0;
+}
 
-    // obj files are created in the build directory following
-    // the same hierarchy & name as the source files
-    char objpath[PATH_MAX] = {0};
+// collects the headers the compiler reported in the translation
+// unit's dependency file during its last compilation
+static int read_tu_depfile(struct build_target *target, struct srcinfo *src, struct header_list *out) {
+    struct depfile_ctx dctx = {
+        .target = target,
+        .srcpath = src->path,
+        .headers = out,
+    };
+    return foreach_depfile_prerequisite(&dctx, src->deppath, collect_prerequisite_cb);
+}
+
+// obj files are created in the build directory following
+// the same hierarchy & name as the source files
+static void get_objpath(struct build_target *target, const char *srcpath, char *objpath, size_t size) {
     size_t reqsize;
 
-    reqsize = cwk_path_join(state->target_opts->build_root.cstr, src->path, objpath, sizeof objpath);
-    if (reqsize >= sizeof objpath) {
+    reqsize = cwk_path_join(target->opts->build_root.cstr, srcpath, objpath, size);
+    if (reqsize >= size) {
         printf("%s: cwk_path_join failed\n", __func__);
         abort();
     }
 
-    reqsize = cwk_path_change_extension(objpath, ".o", objpath, sizeof objpath);
-    if (reqsize >= sizeof objpath) {
+    reqsize = cwk_path_change_extension(objpath, ".o", objpath, size);
+    if (reqsize >= size) {
         printf("%s: cwk_path_change_extension failed\n", __func__);
         abort();
     }
+}
 
-    if (src->main_file) {
-        str_list_new_node(&state->main_files, objpath);
-    } else {
-        str_list_new_node(&state->obj_files, objpath);
+// a recorded translation unit can be reused without reading any
+// source when neither it nor any of its headers changed since
+// the previous build, which depdb_mark_dirty already worked out
+static bool tu_is_current(struct depdb *db, struct depdb_tu *tu, const char *objpath) {
+    if (tu == NULL || strcmp(tu->objpath, objpath) != 0) {
+        return false;
     }
+    return !depdb_tu_dirty(db, tu);
+}
 
-    time_t objlastmodified = ccfs_last_modified_time(objpath);
-    if (objlastmodified > src->lastmodified && objlastmodified > state->target_opts->lastmodified) {
-        // TOOD: look into using file hashes to identify changes?
-        // not sure if this would be faster/slower than just a quick
-        // rebuild...
-        return 0;
+// expands the compile command, returns false if the obj is up to date
+static bool compile_needed(struct build_target *target, struct srcinfo *src, struct command *cmd) {
+    assert(target != NULL);
+    assert(src != NULL);
+
+    const char *objpath = src->objpath;
+
+    struct command_var vars[] = {
+        { "[OBJPATH]", objpath },
+        { "[SRCPATH]", src->path },
+        { "[DEPPATH]", src->deppath },
+    };
+    struct command command;
+    command_expand(&target->compile_cmd, vars, sizeof vars / sizeof vars[0], &command);
+    command_set_label(&command, src->path);
+    src->cmdhash = cc_hash64(command.line, strlen(command.line), 0);
+
+    struct ccfs_stamp objstamp;
+    bool objexists = ccfs_file_stamp(objpath, &objstamp) == 0;
+
+    bool uptodate;
+    if (src->recorded) {
+        // inputs are compared by contents, so touching a file
+        // without changing it does not cause a recompile, and only
+        // the objs whose expanded command changed are rebuilt
+        uptodate = objexists && !src->stale && src->cmdhash == src->recorded_cmdhash;
+    } else {
+        // without a record all that is known is the config's mtime
+        uptodate = objexists && objstamp.mtime_ns > src->lastmodified_ns
+                && objstamp.mtime_ns / 1000000000 > target->opts->lastmodified;
+    }
+    if (uptodate) {
+        command_free(&command);
+        return false;
     }
-    if (objlastmodified == -1) {
+    if (!objexists) {
         // obj does not exist, create full path in case dir structure
         // also does not exist
         size_t dirname_size;
@@ -106,61 +269,229 @@ static int compile_source(struct build_state *state, struct srcinfo *src) {
         ccfs_mkdirp(tmpdirpath);
     }
 
-    ccstr command = ccstrdup(state->target_opts->compile);
-    ccstr_replace(&command, CCSTRVIEW_STATIC("[OBJPATH]"), ccsv_raw(objpath));
-    ccstr_replace(&command, CCSTRVIEW_STATIC("[SRCPATH]"), ccsv_raw(src->path));
-    int ret = execute_command(command);
+    *cmd = command;
+    return true;
+}
 
-    ccstr_free(&command);
-    return ret;
+// objs with an entry point are each linked into their own executable
+static void register_obj(struct build_target *target, struct srcinfo *src) {
+    if (src->main_file) {
+        str_list_new_node(&target->main_files, src->objpath);
+    } else {
+        str_list_new_node(&target->obj_files, src->objpath);
+    }
 }
 
-static void compile_translation_unit_cb(void*ctx) {
-    struct compilation_task_ctx taskctx = *(struct compilation_task_ctx*)ctx;
-    struct build_state *state = taskctx.state;
-    const char *filepath = taskctx.srcpath.cstr;
+// the scanner can be fooled by macros, but the obj's symbol table can't,
+// objs in other formats than ELF keep what the scanner found
+static void verify_entry_point(struct depdb *db, struct depdb_tu *tu, struct srcinfo *src) {
+    bool defines_main;
+    if (obj_defines_symbol(src->objpath, "main", &defines_main) != 0) {
+        return;
+    }
+    if (defines_main != src->main_file) {
+        src->main_file = defines_main;
+        depdb_set_main_file(db, tu, defines_main);
+    }
+}
 
-    // filter by file type
+// filter by file type
+static bool is_source_file(const char *filepath) {
     const char *ext = NULL;
     size_t extlen = 0;
 
     if (!cwk_path_get_extension(filepath, &ext, &extlen)){
-        return; // no extension, skip
-    }
-
-    bool cext = strcmp(ext, ".c") == 0 || strcmp(ext, ".C") == 0
-                || strcmp(ext, ".cpp") == 0 || strcmp(ext, ".cc") == 0;
-
-    if (!cext) {
-        return; // not source file, skip
+        return false; // no extension, skip
     }
+    return strcmp(ext, ".c") == 0 || strcmp(ext, ".C") == 0
+        || strcmp(ext, ".cpp") == 0 || strcmp(ext, ".cc") == 0;
+}
 
-    // get path relative to project root
-    char relpath[PATH_MAX];
+// get normalized path relative to project root, the same
+// form the include resolver and depfiles produce
+static void get_relpath(struct build_target *target, const char *filepath, char *relpath, size_t size) {
     if (!cwk_path_is_relative(filepath)) {
-        size_t reqsize = cwk_path_get_relative(state->rootdir.cstr, filepath, relpath, sizeof relpath);
-        if (reqsize >= sizeof relpath) {
+        size_t reqsize = cwk_path_get_relative(target->state->rootdir.cstr, filepath, relpath, size);
+        if (reqsize >= size) {
             printf("%s: cwk_path_get_relative failed\n", __func__);
             abort();
         }
     } else {
-        strcpy(relpath, filepath);
+        size_t reqsize = cwk_path_normalize(filepath, relpath, size);
+        if (reqsize >= size) {
+            printf("%s: cwk_path_normalize failed\n", __func__);
+            abort();
+        }
     }
+}
+
+// called on the executor's event loop once the compiler exited
+static void compile_done_cb(void *ctx, int status, uint64_t duration_ns) {
+    struct compilation_task_ctx *taskctx = ctx;
+    taskctx->ret = status;
+    taskctx->src.duration_ns = duration_ns;
+    taskctx->src.compiled = true;
+    cc_taskgraph_release(&taskctx->target->state->graph, taskctx->finish);
+}
 
-    struct srcinfo src_info = {
-        .translation_unit = cext,
-        .lastmodified = ccfs_last_modified_time(relpath),
-        .main_file = has_entry_point(relpath),
+// works out what the translation unit depends on and starts its compile
+// if needed, the finish node runs once the compile is done
+static void start_translation_unit(struct compilation_task_ctx *taskctx) {
+    struct build_target *target = taskctx->target;
+    struct cc_taskgraph *graph = &target->state->graph;
+    const char *filepath = taskctx->srcpath.cstr;
+
+    if (!is_source_file(filepath)) {
+        cc_taskgraph_release(graph, taskctx->finish);
+        return; // not source file, skip
+    }
+
+    char *relpath = taskctx->relpath;
+    get_relpath(target, filepath, relpath, sizeof taskctx->relpath);
+
+    char *objpath = taskctx->objpath;
+    get_objpath(target, relpath, objpath, sizeof taskctx->objpath);
+
+    char *deppath = taskctx->deppath;
+    cwk_path_change_extension(objpath, ".d", deppath, sizeof taskctx->deppath);
+
+    struct srcinfo *src = &taskctx->src;
+    *src = (struct srcinfo) {
+        .translation_unit = true,
         .path = relpath,
+        .objpath = objpath,
+        .deppath = deppath,
     };
 
-    // get lastmodified time from all included headers as well
-    struct fid_ctx fidctx = {
-        .state = state,
-        .lastmodified = &src_info.lastmodified,
-    };
-    foreach_include_directive(&fidctx, relpath, update_lastmodified_cb);
-    compile_source(state, &src_info);
+    struct depdb *db = &target->depdb;
+    struct depdb_tu *tu = depdb_find_tu(db, relpath);
+    src->recorded = tu != NULL && strcmp(tu->objpath, objpath) == 0;
+    if (src->recorded) {
+        src->recorded_cmdhash = tu->cmdhash;
+    }
+
+    if (tu_is_current(db, tu, objpath)) {
+        // nothing changed, reuse what the previous build learned
+        depdb_keep_tu(db, tu);
+        src->main_file = tu->main_file;
+        src->stale = !tu->built;
+    } else {
+        struct depdb_file *srcfile = depdb_file(db, relpath);
+        bool src_changed = depdb_file_changed(db, srcfile);
+        src->lastmodified_ns = srcfile->current.mtime_ns;
+        src->stale = true;
+
+        // the entry point can only change along with the source
+        taskctx->rescan_main = (tu == NULL || src_changed);
+        if (!taskctx->rescan_main) {
+            src->main_file = tu->main_file;
+        }
+
+        // the compiler reports the exact dependencies along with the obj,
+        // and without an obj the source is compiled anyway, so only fall
+        // back to scanning when switching over an existing build
+        struct header_list headers = {0};
+        bool from_depfile = false;
+        if (target->depfiles) {
+            from_depfile = !ccfs_is_regular_file(objpath)
+                        || read_tu_depfile(target, src, &headers) == 0;
+        }
+        // either way the source is read at most once
+        bool *entry_point = taskctx->rescan_main ? &src->main_file : NULL;
+        if (!from_depfile) {
+            scan_tu_includes(target, relpath, &headers, entry_point);
+        } else if (entry_point != NULL) {
+            scan_source_file(relpath, NULL, NULL, entry_point);
+        }
+        for (size_t i = 0; i < headers.count; ++i) {
+            if (headers.items[i]->current.mtime_ns > src->lastmodified_ns) {
+                src->lastmodified_ns = headers.items[i]->current.mtime_ns;
+            }
+        }
+        tu = depdb_update_tu(db, relpath, objpath, src->main_file, headers.items, headers.count, from_depfile);
+        free(headers.items);
+    }
+    taskctx->tu = tu;
+
+    // the compiler runs on the executor, no thread waits for it
+    struct command command;
+    if (compile_needed(target, src, &command)) {
+        executor_run(&target->state->executor, &command, taskctx, compile_done_cb);
+    } else {
+        cc_taskgraph_release(graph, taskctx->finish);
+    }
+}
+
+// records the outcome of the compile, returns non-zero if it failed
+static int finish_translation_unit(struct compilation_task_ctx *taskctx) {
+    struct build_target *target = taskctx->target;
+    struct depdb *db = &target->depdb;
+    struct srcinfo *src = &taskctx->src;
+    struct depdb_tu *tu = taskctx->tu;
+    int ret = taskctx->ret;
+
+    if (ret == 0 && src->compiled && target->depfiles) {
+        struct header_list headers = {0};
+        if (read_tu_depfile(target, src, &headers) == 0) {
+            tu = depdb_update_tu(db, src->path, src->objpath, src->main_file, headers.items, headers.count, true);
+        }
+        free(headers.items);
+    }
+    if (ret == 0 && (src->compiled || taskctx->rescan_main)) {
+        verify_entry_point(db, tu, src);
+    }
+    depdb_set_built(db, tu, ret == 0, src->cmdhash);
+    if (ret == 0 && src->compiled) {
+        depdb_set_duration(db, tu, src->duration_ns);
+    }
+    register_obj(target, src);
+    return ret;
+}
+
+// a cancelled build keeps the record of a translation unit it did not
+// get to, but a dirty one must not look built to the next build
+static void skip_translation_unit(struct build_target *target, const char *filepath) {
+    if (!is_source_file(filepath)) {
+        return;
+    }
+    char relpath[PATH_MAX];
+    get_relpath(target, filepath, relpath, sizeof relpath);
+
+    struct depdb *db = &target->depdb;
+    struct depdb_tu *tu = depdb_find_tu(db, relpath);
+    if (tu == NULL) {
+        return;
+    }
+    depdb_keep_tu(db, tu);
+    if (depdb_tu_dirty(db, tu)) {
+        depdb_set_built(db, tu, false, tu->cmdhash);
+    }
+}
+
+// task graph node, one per file found in the target's SRCPATHS
+static void compile_translation_unit_cb(void *ctx) {
+    struct compilation_task_ctx *taskctx = ctx;
+    struct build_target *target = taskctx->target;
+
+    if (cc_threadpool_cancelled(&target->state->threadpool)) {
+        skip_translation_unit(target, taskctx->srcpath.cstr);
+        cc_taskgraph_release(&target->state->graph, taskctx->finish);
+    } else {
+        start_translation_unit(taskctx);
+    }
+}
+
+// task graph node, runs once the compile started by the node above is done
+static void finish_translation_unit_cb(void *ctx) {
+    struct compilation_task_ctx *taskctx = ctx;
+    struct build_target *target = taskctx->target;
+
+    if (taskctx->src.translation_unit && finish_translation_unit(taskctx) != 0) {
+        atomic_store(&target->inputs_failed, true);
+        build_error(target, "compile", taskctx->srcpath.cstr);
+    }
+    ccstr_free(&taskctx->srcpath);
+    free(taskctx);
 }
 
 #endif // CMD_BUILD_COMPILE_H
\ No newline at end of file
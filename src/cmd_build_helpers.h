@@ -10,12 +10,21 @@
 #define CMD_BUILD_HELPERS_H
 
 #include "cmd.h"
+#include "process.h"
 #include "str_list.h"
 
 #include "libcc/cc_strings.h"
 #include "libcc/cc_files.h"
 
 #include <stdio.h>
+#include <time.h>
+
+// monotonic wall time, used to time compiles and links
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
 // iterate over all targets in the trie_map
 static void foreach_target(struct build_state *state, int (*callback)(void *ctx, void *data)) {
@@ -23,12 +32,12 @@ static void foreach_target(struct build_state *state, int (*callback)(void *ctx,
 }
 
 // iterate over the list of files with entry-points
-static void foreach_main_file(struct build_state *state, int (*callback)(void *ctx, char *str)) {
-    str_list_iterate(&state->main_files, state, callback);
+static void foreach_main_file(struct build_target *target, int (*callback)(void *ctx, char *str)) {
+    str_list_iterate(&target->main_files, target, callback);
 }
 
 // iterate over all files found in the SRCPATHS directory paths list
-static int foreach_src_file(struct build_state *state, ccstr srcpaths, int (*callback)(void *ctx, const char *data)) {
+static int foreach_src_file(struct build_target *target, ccstr srcpaths, int (*callback)(void *ctx, const char *data)) {
     ccstrview sv = ccsv(&srcpaths);
     ccstrview path;
 
@@ -37,87 +46,89 @@ static int foreach_src_file(struct build_state *state, ccstr srcpaths, int (*cal
 
         char pathstr[PATH_MAX] = {0};
         memcpy(pathstr, path.cstr, path.len);
-        if (ccfs_iterate_files(pathstr, state, callback) == -1) {
+        if (ccfs_iterate_files(pathstr, target, callback) == -1) {
             return -1;
         }
     }
     return 0;
 }
 
-// iterate over all files found included in a source file
-static void foreach_include_directive(void *ctx, const char *srcpath, int (*callback)(void *ctx, const char *header)) {
-    FILE *file = fopen(srcpath, "r");
-    if (!file) {
-        // failure here could simply mean the header is from outside
-        // the project (systems includes). We'll skip these, assuming
-        // they wont change (often)
-        return;
+// iterate over the prerequisites of the first rule in a make style
+// dependency file, as written by the compiler with -MMD -MF
+static int foreach_depfile_prerequisite(void *ctx, const char *deppath, int (*callback)(void *ctx, const char *prereq)) {
+    ccstrview contents;
+    if (ccfs_map_readonly(deppath, &contents) != 0) {
+        return -1;
     }
-    char line[1024];
-    while (fgets(line, sizeof(line), file)) {
-
-        if (strncmp(line, "#include", 8) == 0) {
-            // get the included file name
-            char *start = strchr(line, '<');
-            if (!start) {
-                start = strchr(line, '"');
-            }
-            if (start) {
-                char *end = strchr(start + 1, (start[0] == '<') ? '>' : '"');
-                if (end) {
-                    *end = '\0';
-                    callback(ctx, start+1);
-                }
-            }
-        }
-    }
-    fclose(file);
-}
+    const char *p = contents.cstr;
+    const char *end = contents.cstr + contents.len;
 
-// detect if a source file has an entry point (main function)
-static bool has_entry_point(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        perror("Unable to open file");
-        return false;
+    // skip the target, windows paths can contain a ':' so the
+    // separator is the first ':' followed by whitespace
+    while (p < end && !(p[0] == ':' && (p + 1 == end || p[1] == ' ' || p[1] == '\t' || p[1] == '\r' || p[1] == '\n'))) {
+        ++p;
     }
-    char line[1024];
-    bool in_string = false;
-    bool in_comment = false;
-    bool in_multiline_comment = false;
-    while (fgets(line, sizeof(line), file)) {
-        for (int i = 0; line[i] != '\0'; i++) {
-            if (!in_multiline_comment && !in_comment && line[i] == '\"' && (i == 0 || line[i-1] != '\\')) {
-                in_string = !in_string;
-            }
-            if (!in_string && !in_multiline_comment && line[i] == '/' && line[i+1] == '/') {
-                in_comment = true;
-                break;
-            }
-            if (!in_string && !in_multiline_comment && line[i] == '/' && line[i+1] == '*') {
-                in_multiline_comment = true;
-                i++;
-                continue;
-            }
-            if (!in_string && in_multiline_comment && line[i] == '*' && line[i+1] == '/') {
-                in_multiline_comment = false;
-                i++;
-                continue;
+    if (p == end) {
+        ccfs_unmap(&contents);
+        return -1;
+    }
+    ++p;
+
+    char prereq[PATH_MAX];
+    size_t len = 0;
+
+    for (;;) {
+        char c = (p < end) ? *p++ : 0;
+        bool separator = (c == 0 || c == '\n' || c == ' ' || c == '\t' || c == '\r');
+        bool more = (p < end);
+
+        if (c == '\\' && more && (*p == '\n' || (*p == '\r' && p + 1 < end && p[1] == '\n'))) {
+            // line continuation, acts as a separator
+            p += (*p == '\r') ? 2 : 1;
+            separator = true;
+        } else if (c == '\\' && more && (*p == ' ' || *p == '#')) {
+            c = *p++;
+        } else if (c == '$' && more && *p == '$') {
+            ++p;
+        }
+        if (separator) {
+            if (len > 0) {
+                prereq[len] = 0;
+                callback(ctx, prereq);
+                len = 0;
             }
-            if (!in_string && !in_comment && !in_multiline_comment && strncmp(line + i, "int main(", 9) == 0) {
-                fclose(file);
-                return true;
+            if (c == 0 || c == '\n') {
+                break; // end of the rule
             }
+            continue;
+        }
+        if (len + 1 >= sizeof prereq) {
+            printf("%s: path too long in '%s'\n", __func__, deppath);
+            break;
         }
-        in_comment = false;
+        prereq[len++] = c;
     }
-    fclose(file);
-    return false;
+    ccfs_unmap(&contents);
+    return 0;
 }
 
-static int execute_command(ccstr command) {
-    printf("%s\n", command.cstr);
-    return system(command.cstr);
+// records a failed compile or link, and unless the build keeps going
+// stops it: queued compiles and links are skipped and the commands
+// that are still running are terminated
+static void build_error(struct build_target *target, const char *action, const char *path) {
+    struct build_state *state = target->state;
+    atomic_store(&target->failed, true);
+    atomic_store(&state->failed, true);
+
+    // commands terminated by the first error fail too, that is not news
+    if (cc_threadpool_cancelled(&state->threadpool)) {
+        return;
+    }
+    printf("error: failed to %s '%s'\n", action, path);
+    if (!state->cmdopts.keep_going && cc_threadpool_cancel(&state->threadpool)) {
+        printf("INFO: stopping the build after the first error (use --keep-going to continue)\n");
+        process_terminate_all();
+    }
 }
 
 #endif // CMD_BUILD_HELPERS_H
\ No newline at end of file
@@ -13,17 +13,36 @@
 #include "cmd_build_helpers.h"
 #include "build_opts.h"
 
-static
-int link_object_files_cb(void *ctx, char *main_obj) {
-    struct build_state *state = ctx;
-    int reqsize = str_list_concat(&state->obj_files, ' ', NULL, 0);
+#include "libcc/cc_hash.h"
 
-    char objfiles[reqsize];
-    str_list_concat(&state->obj_files, ' ', objfiles, reqsize);
+// libraries are named lib<LIBNAME>, or lib<TARGET> by default, set
+// once before any link runs since the libs of a target link concurrently
+static void resolve_libname(struct build_opts *bopts) {
+    if (bopts->libname.len == 0) {
+        ccstr_append(&bopts->libname, ccsv(&bopts->target));
+    }
 
-    char all_obj_files[4096] = {0};
-    snprintf(all_obj_files, sizeof(all_obj_files), "%s %s", objfiles, main_obj);
+    if (strstr(bopts->libname.cstr, "lib") != bopts->libname.cstr) {
+        ccstr tmp = CCSTR_LITERAL("lib");
+        ccstr_append(&tmp, ccsv(&bopts->libname));
+        ccstrcpy(&bopts->libname, tmp);
+        ccstr_free(&tmp);
+    }
+}
 
+// creates the directory the binary is installed to
+static void make_parent_dir(const char *binpath) {
+    size_t dirname_len;
+    cwk_path_get_dirname(binpath, &dirname_len);
+
+    char tmpdirpath[PATH_MAX];
+    strncpy(tmpdirpath, binpath, dirname_len-1);
+    tmpdirpath[dirname_len-1] = 0;
+    ccfs_mkdirp(tmpdirpath);
+}
+
+// executables are named after their main obj
+static void executable_path(struct build_target *target, const char *main_obj, char *binpath, size_t size) {
     size_t base_name_len;
     const char *base_name_ptr;
     cwk_path_get_basename(main_obj, &base_name_ptr, &base_name_len);
@@ -31,106 +50,303 @@ int link_object_files_cb(void *ctx, char *main_obj) {
     char *extpos = strchr(base_name_ptr, '.');
     ccstr name = ccstr_rawlen(base_name_ptr, extpos-base_name_ptr);
 
-    if (state->target_opts->installdir.len == 0) {
-        ccstr_append(&state->target_opts->installdir, CCSTRVIEW_STATIC("/"));
-    }
-
     const char *path_segments[] = {
-        state->target_opts->install_root.cstr,
-        state->target_opts->installdir.cstr,
+        target->opts->install_root.cstr,
+        target->opts->installdir.cstr,
         name.cstr,
         NULL,
     };
+    cwk_path_join_multiple((const char **)&path_segments, binpath, size);
+    ccstr_free(&name);
+}
 
-    char binpath[PATH_MAX] = {0};
-    cwk_path_join_multiple((const char **)&path_segments, binpath, sizeof binpath);
-
-    size_t dirname_len;
-    cwk_path_get_dirname(binpath, &dirname_len);
-
-    char tmpdirpath[PATH_MAX];
-    strncpy(tmpdirpath, binpath, dirname_len-1);
-    tmpdirpath[dirname_len-1] = 0;
-    ccfs_mkdirp(tmpdirpath);
+// the link commands add the extension of the library
+static void library_path(struct build_target *target, char *binpath, size_t size) {
+    struct build_opts *bopts = target->opts;
+    const char *path_segments[] = {
+        bopts->install_root.cstr,
+        bopts->installdir.cstr,
+        bopts->libname.cstr,
+        NULL,
+    };
+    cwk_path_join_multiple((const char **)&path_segments, binpath, size);
+}
 
-    ccstr_free(&name);
+// object lists longer than this are passed in a response file, one
+// argument of a shell command is limited to 128KB on linux, and a whole
+// command line to 32KB on windows
+#define RESPONSE_FILE_THRESHOLD (16 * 1024)
 
-    ccstr command = ccstrdup(state->target_opts->link);
-    ccstr_replace(&command, ccsv_raw("[OBJS]"), ccsv_raw(all_obj_files));
-    ccstr_replace(&command, ccsv_raw("[BINPATH]"), ccsv_raw(binpath));
+static uint64_t hash_stamp(uint64_t hash, const char *path, const struct ccfs_stamp *stamp) {
+    hash = cc_hash64(path, strlen(path) + 1, hash);
+    return cc_hash64(stamp, sizeof *stamp, hash);
+}
 
-    printf("\nINFO: linking exec '%s'\n", binpath);
-    int ret = execute_command(command);
+static int collect_obj_cb(void *ctx, char *objpath) {
+    struct build_target *target = ctx;
+    target->objs[target->nobjs++] = objpath;
+    return 0;
+}
 
-    ccstr_free(&command);
-    return ret;
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
 }
 
-static
-int link_libs(struct build_state *state) {
-    struct build_opts *bopts = state->target_opts;
+// the target's shared objs, set once all of them are compiled and before
+// any link starts. They are sorted so the link commands don't depend on
+// the order the compiles finished in, and stamped once for all the links
+static void collect_obj_files(struct build_target *target) {
+    size_t count = target->obj_files.count;
+    target->objs = malloc((count + 1) * sizeof *target->objs);
+    target->obj_stamps = malloc((count + 1) * sizeof *target->obj_stamps);
+    if (target->objs == NULL || target->obj_stamps == NULL) {
+        printf("%s: out of memory\n", __func__);
+        abort();
+    }
+    target->nobjs = 0;
+    str_list_iterate(&target->obj_files, target, collect_obj_cb);
+    qsort(target->objs, target->nobjs, sizeof *target->objs, compare_paths);
 
-    int reqsize = str_list_concat(&state->obj_files, ' ', NULL, 0);
+    size_t size = 1;
+    for (size_t i = 0; i < target->nobjs; ++i) {
+        size += strlen(target->objs[i]) + 1;
+    }
+    target->objfiles = malloc(size);
+    if (target->objfiles == NULL) {
+        printf("%s: out of memory\n", __func__);
+        abort();
+    }
 
-    char objfiles[reqsize];
-    str_list_concat(&state->obj_files, ' ', objfiles, reqsize);
+    // space separated
+    char *end = target->objfiles;
+    *end = 0;
+    uint64_t hash = 0;
+    for (size_t i = 0; i < target->nobjs; ++i) {
+        end += sprintf(end, (i == 0) ? "%s" : " %s", target->objs[i]);
+        ccfs_file_stamp(target->objs[i], &target->obj_stamps[i]);
+        hash = hash_stamp(hash, target->objs[i], &target->obj_stamps[i]);
+    }
+    target->objs_fingerprint = hash;
+}
 
-    if (bopts->libname.len == 0) {
-        ccstr_append(&bopts->libname, ccsv(&bopts->target));
+// response files of all targets share the build directory and links run
+// concurrently, so each is named after the whole path of its output
+static void response_file_name(const char *binpath, const char *kind, char *name, size_t size) {
+    snprintf(name, size, "%s%s%s", binpath, kind ? "." : "", kind ? kind : "");
+    for (char *p = name; *p != 0; ++p) {
+        if (*p == '/' || *p == '\\' || *p == ':') {
+            *p = '_';
+        }
     }
+}
 
-    if (strstr(bopts->libname.cstr, "lib") != bopts->libname.cstr) {
-        ccstr tmp = CCSTR_LITERAL("lib");
-        ccstr_append(&tmp, ccsv(&bopts->libname));
-        ccstrcpy(&bopts->libname, tmp);
-        ccstr_free(&tmp);
+// the value of [OBJS], a long list is written to a response file in the
+// build directory and passed as @file, which compilers, linkers and ar
+// all understand
+static char* objs_argument(struct build_target *target, const char *objs, const char *name) {
+    size_t len = strlen(objs);
+    if (len > RESPONSE_FILE_THRESHOLD) {
+        char rsppath[PATH_MAX];
+        const char *path_segments[] = { target->opts->build_root.cstr, name, NULL };
+        cwk_path_join_multiple(path_segments, rsppath, sizeof rsppath);
+        strncat(rsppath, ".rsp", sizeof rsppath - strlen(rsppath) - 1);
+
+        FILE *file = fopen(rsppath, "w");
+        if (file != NULL) {
+            // one obj per line
+            for (const char *p = objs; *p != 0; ++p) {
+                fputc(*p == ' ' ? '\n' : *p, file);
+            }
+            fputc('\n', file);
+            if (fclose(file) == 0) {
+                char *arg = malloc(strlen(rsppath) + 2);
+                if (arg == NULL) {
+                    printf("%s: out of memory\n", __func__);
+                    abort();
+                }
+                sprintf(arg, "@%s", rsppath);
+                return arg;
+            }
+        }
+        printf("INFO: failed to write response file '%s', passing the objs on the command line\n", rsppath);
+    }
+    char *arg = malloc(len + 1);
+    if (arg == NULL) {
+        printf("%s: out of memory\n", __func__);
+        abort();
     }
+    memcpy(arg, objs, len + 1);
+    return arg;
+}
 
-    if (bopts->installdir.len == 0) {
-        ccstr_append(&bopts->installdir, CCSTRVIEW_STATIC("/"));
+// links the target's shared objs together with one main obj
+static
+void executable_link_command(struct build_target *target, const char *main_obj, const char *binpath, struct command *cmd) {
+    size_t len = strlen(target->objfiles);
+    char *all_obj_files = malloc(len + strlen(main_obj) + 2);
+    if (all_obj_files == NULL) {
+        printf("%s: out of memory\n", __func__);
+        abort();
     }
+    sprintf(all_obj_files, "%s%s%s", target->objfiles, len > 0 ? " " : "", main_obj);
 
-    const char *path_segments[] = {
-        bopts->install_root.cstr,
-        bopts->installdir.cstr,
-        bopts->libname.cstr,
-        NULL,
-    };
+    char name[PATH_MAX];
+    response_file_name(binpath, NULL, name, sizeof name);
+    char *objs = objs_argument(target, all_obj_files, name);
 
-    char binpath[PATH_MAX] = {0};
-    cwk_path_join_multiple((const char **)&path_segments, binpath, sizeof binpath);
+    struct command_var vars[] = {
+        { "[OBJS]", objs },
+        { "[BINPATH]", binpath },
+    };
+    command_expand(&target->link_cmd, vars, 2, cmd);
+    command_set_label(cmd, binpath);
+    free(objs);
+    free(all_obj_files);
+}
 
-    size_t dirname_len;
-    cwk_path_get_dirname(binpath, &dirname_len);
+// links the given objs, all of the target's shared objs unless only some
+// members of an archive are replaced, into a library. kind tells the
+// response files of the shared and static library apart
+static
+void library_link_command(struct build_target *target, const struct command_template *tpl, const char *kind,
+                          const char *objfiles, const char *binpath, struct command *cmd) {
+    char name[PATH_MAX];
+    response_file_name(binpath, kind, name, sizeof name);
+    char *objs = objs_argument(target, objfiles, name);
+
+    struct command_var vars[] = {
+        { "[OBJS]", objs },
+        { "[BINPATH]", binpath },
+    };
+    command_expand(tpl, vars, 2, cmd);
+    command_set_label(cmd, binpath);
+    free(objs);
+}
 
-    char tmpdirpath[PATH_MAX];
-    strncpy(tmpdirpath, binpath, dirname_len-1);
-    tmpdirpath[dirname_len-1] = 0;
-    ccfs_mkdirp(tmpdirpath);
+// the file a link command writes: the templates append the extension of
+// libraries to [BINPATH], so it is the word of the command starting with
+// the binpath (or following an attached -o). Returns false when there is
+// no such word, the output is then assumed to be the binpath itself
+static bool link_output_path(const char *line, const char *binpath, char *outpath, size_t size) {
+    size_t len = strlen(binpath);
+    for (const char *p = strstr(line, binpath); p != NULL; p = strstr(p + len, binpath)) {
+        bool word = (p == line) || p[-1] == ' ' || p[-1] == '\t'
+                 || (p - line >= 2 && p[-1] == 'o' && p[-2] == '-');
+        if (word) {
+            snprintf(outpath, size, "%.*s", (int)strcspn(p, " \t"), p);
+            return true;
+        }
+    }
+    snprintf(outpath, size, "%s", binpath);
+    return false;
+}
 
-    int ret = 0;
+// everything the output of a link depends on: the paths and stamps of its
+// objs, the expanded command and the outputs of the targets in DEPENDS,
+// which an archive does not contain
+static uint64_t link_fingerprint(struct build_target *target, const char *main_obj, const struct command *cmd, bool archive) {
+    uint64_t hash = target->objs_fingerprint;
+    if (main_obj != NULL) {
+        struct ccfs_stamp stamp;
+        ccfs_file_stamp(main_obj, &stamp);
+        hash = hash_stamp(hash, main_obj, &stamp);
+    }
+    if (!archive) {
+        hash = cc_hash64(&target->deps_fingerprint, sizeof target->deps_fingerprint, hash);
+    }
+    return cc_hash64(cmd->line, strlen(cmd->line), hash);
+}
 
-    if (bopts->type & SHARED) {
-        ccstr command = ccstrdup(state->target_opts->link_shared);
-        ccstr_replace(&command, ccsv_raw("[OBJS]"), ccsv_raw(objfiles));
-        ccstr_replace(&command, ccsv_raw("[BINPATH]"), ccsv_raw(binpath));
+// true if the output is still what the recorded link wrote
+static bool output_unchanged(const char *outpath, const struct depdb_link *link) {
+    struct ccfs_stamp stamp;
+    return ccfs_file_stamp(outpath, &stamp) == 0
+        && stamp.mtime_ns == link->output.mtime_ns
+        && stamp.size == link->output.size
+        && stamp.inode == link->output.inode;
+}
 
-        printf("\nINFO: linking shared '%s'\n", binpath);
-        ret = execute_command(command);
-        ccstr_free(&command);
+// archives written by ar (or gcc-ar, llvm-ar, ...) with the r key can
+// be updated in place, ar replaces the members it is given and keeps
+// all the others
+static bool is_ar_command(const struct command_template *tpl) {
+    if (tpl->shell || tpl->argc < 2) {
+        return false;
     }
+    const char *name;
+    size_t len;
+    cwk_path_get_basename(tpl->argv[0], &name, &len);
+    bool ar = (len == 2 || (len > 2 && name[len - 3] == '-')) && strncmp(name + len - 2, "ar", 2) == 0;
+    return ar && strchr(tpl->argv[1], 'r') != NULL;
+}
 
-    if (bopts->type & STATIC) {
-        ccstr command = ccstrdup(state->target_opts->link_static);
-        ccstr_replace(&command, ccsv_raw("[OBJS]"), ccsv_raw(objfiles));
-        ccstr_replace(&command, ccsv_raw("[BINPATH]"), ccsv_raw(binpath));
+static int compare_basenames(const void *a, const void *b) {
+    const char *name_a, *name_b;
+    size_t len_a, len_b;
+    cwk_path_get_basename(*(char * const *)a, &name_a, &len_a);
+    cwk_path_get_basename(*(char * const *)b, &name_b, &len_b);
+    return strcmp(name_a, name_b);
+}
 
-        printf("\nINFO: linking static '%s'\n", binpath);
-        ret = execute_command(command);
-        ccstr_free(&command);
+// ar tells members apart by their basename only, objs of sources with the
+// same name in different directories are all members of the same name,
+// and replacing one of them replaces whichever comes first
+static bool has_duplicate_basenames(struct build_target *target) {
+    char **objs = malloc((target->nobjs + 1) * sizeof *objs);
+    if (objs == NULL) {
+        printf("%s: out of memory\n", __func__);
+        abort();
+    }
+    memcpy(objs, target->objs, target->nobjs * sizeof *objs);
+    qsort(objs, target->nobjs, sizeof *objs, compare_basenames);
+    bool duplicates = false;
+    for (size_t i = 1; i < target->nobjs && !duplicates; ++i) {
+        duplicates = (compare_basenames(&objs[i - 1], &objs[i]) == 0);
     }
+    free(objs);
+    return duplicates;
+}
 
-    return ret;
+// the objs of the target that changed since they were last archived,
+// space separated, or NULL when the archive must be written from scratch:
+// it lost members, none changed so it was the command that did, or ar
+// can't tell the changed members apart from others of the same name
+static char* changed_members(struct build_target *target, const struct depdb_link *link) {
+    if (has_duplicate_basenames(target)) {
+        return NULL;
+    }
+    char *changed = malloc(strlen(target->objfiles) + 1);
+    if (changed == NULL) {
+        printf("%s: out of memory\n", __func__);
+        abort();
+    }
+    char *end = changed;
+    *end = 0;
+
+    // both lists are sorted by path
+    size_t j = 0;
+    for (size_t i = 0; i < target->nobjs; ++i) {
+        const char *objpath = target->objs[i];
+        const struct ccfs_stamp *stamp = &target->obj_stamps[i];
+        int cmp = (j < link->nmembers) ? strcmp(link->members[j].objpath, objpath) : 1;
+        if (cmp < 0) {
+            free(changed);
+            return NULL; // the obj of a member is gone
+        }
+        if (cmp == 0) {
+            const struct ccfs_stamp *recorded = &link->members[j++].stamp;
+            if (stamp->mtime_ns == recorded->mtime_ns && stamp->size == recorded->size
+                && stamp->inode == recorded->inode) {
+                continue;
+            }
+        }
+        end += sprintf(end, (end == changed) ? "%s" : " %s", objpath);
+    }
+    if (j < link->nmembers || end == changed) {
+        free(changed);
+        return NULL;
+    }
+    return changed;
 }
 
-#endif // CMD_BUILD_LINK_H
\ No newline at end of file
+#endif // CMD_BUILD_LINK_H
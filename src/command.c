@@ -0,0 +1,233 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2025 Josh Simonot
+ */
+
+#include "command.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void* xmalloc(size_t size) {
+    void *ptr = malloc(size);
+    if (ptr == NULL) {
+        printf("%s: out of memory\n", __func__);
+        abort();
+    }
+    return ptr;
+}
+
+static char* xstrdup(const char *str) {
+    size_t len = strlen(str);
+    char *copy = xmalloc(len + 1);
+    memcpy(copy, str, len + 1);
+    return copy;
+}
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// a placeholder is an upper case name in brackets, any other bracket
+// is a shell glob
+static size_t placeholder_len(const char *str) {
+    size_t len = 1;
+    while ((str[len] >= 'A' && str[len] <= 'Z') || str[len] == '_') {
+        ++len;
+    }
+    return (len > 1 && str[len] == ']') ? len + 1 : 0;
+}
+
+static bool uses_shell_syntax(const char *text) {
+    for (const char *p = text; *p != 0; ++p) {
+        if (*p == '[') {
+            size_t len = placeholder_len(p);
+            if (len == 0) {
+                return true;
+            }
+            p += len - 1;
+        } else if (strchr("|&;<>()$`\\\"'*?~#{}!\n", *p) != NULL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void command_template_init(struct command_template *tpl, const char *text) {
+    memset(tpl, 0, sizeof *tpl);
+    tpl->text = xstrdup(text);
+    tpl->shell = uses_shell_syntax(text);
+    if (tpl->shell) {
+        return;
+    }
+
+    // the words are split in place in a copy of the text, stored
+    // right after the argv
+    size_t len = strlen(text);
+    size_t maxwords = len / 2 + 1;
+    tpl->argv = xmalloc((maxwords + 1) * sizeof(char *) + len + 1);
+    char *words = (char *)(tpl->argv + maxwords + 1);
+    memcpy(words, text, len + 1);
+
+    char *p = words;
+    for (;;) {
+        while (is_space(*p)) {
+            ++p;
+        }
+        if (*p == 0) {
+            break;
+        }
+        tpl->argv[tpl->argc++] = p;
+        while (*p != 0 && !is_space(*p)) {
+            ++p;
+        }
+        if (*p != 0) {
+            *p++ = 0;
+        }
+    }
+    tpl->argv[tpl->argc] = NULL;
+
+    // an environment assignment in front of the program needs the shell
+    if (tpl->argc == 0 || strchr(tpl->argv[0], '=') != NULL) {
+        free(tpl->argv);
+        tpl->argv = NULL;
+        tpl->argc = 0;
+        tpl->shell = true;
+    }
+}
+
+void command_template_free(struct command_template *tpl) {
+    free(tpl->text);
+    free(tpl->argv);
+    memset(tpl, 0, sizeof *tpl);
+}
+
+// returns a copy of str with every occurrence of search replaced
+static char* replace_all(const char *str, const char *search, const char *value) {
+    size_t searchlen = strlen(search);
+    size_t valuelen = strlen(value);
+
+    size_t count = 0;
+    for (const char *p = strstr(str, search); p != NULL; p = strstr(p + searchlen, search)) {
+        ++count;
+    }
+    size_t len = strlen(str) + count * valuelen - count * searchlen;
+    char *result = xmalloc(len + 1);
+
+    char *out = result;
+    const char *p = str;
+    for (const char *found = strstr(p, search); found != NULL; found = strstr(p, search)) {
+        memcpy(out, p, found - p);
+        out += found - p;
+        memcpy(out, value, valuelen);
+        out += valuelen;
+        p = found + searchlen;
+    }
+    strcpy(out, p);
+    return result;
+}
+
+static char* expand(const char *str, const struct command_var *vars, size_t nvars) {
+    char *result = xstrdup(str);
+    for (size_t i = 0; i < nvars; ++i) {
+        char *replaced = replace_all(result, vars[i].name, vars[i].value);
+        free(result);
+        result = replaced;
+    }
+    return result;
+}
+
+struct arg_buffer {
+    char *data; // the arguments, each terminated by a 0
+    size_t len;
+    size_t cap;
+    size_t count;
+};
+
+static void append_arg(struct arg_buffer *buf, const char *arg, size_t len) {
+    if (buf->len + len + 1 > buf->cap) {
+        buf->cap = (buf->len + len + 1) * 2;
+        buf->data = realloc(buf->data, buf->cap);
+        if (buf->data == NULL) {
+            printf("%s: out of memory\n", __func__);
+            abort();
+        }
+    }
+    memcpy(buf->data + buf->len, arg, len);
+    buf->data[buf->len + len] = 0;
+    buf->len += len + 1;
+    buf->count++;
+}
+
+// splits an expanded word into arguments, like the shell would
+static void append_split(struct arg_buffer *buf, const char *word) {
+    const char *p = word;
+    for (;;) {
+        while (is_space(*p)) {
+            ++p;
+        }
+        if (*p == 0) {
+            return;
+        }
+        const char *start = p;
+        while (*p != 0 && !is_space(*p)) {
+            ++p;
+        }
+        append_arg(buf, start, p - start);
+    }
+}
+
+void command_expand(const struct command_template *tpl, const struct command_var *vars, size_t nvars, struct command *cmd) {
+    cmd->line = expand(tpl->text, vars, nvars);
+    cmd->argv = NULL;
+    cmd->label = NULL;
+    if (tpl->shell) {
+        return;
+    }
+
+    // only words with a placeholder are expanded and split again
+    struct arg_buffer buf = {0};
+    for (size_t i = 0; i < tpl->argc; ++i) {
+        const char *word = tpl->argv[i];
+        if (strchr(word, '[') == NULL) {
+            append_arg(&buf, word, strlen(word));
+            continue;
+        }
+        char *expanded = expand(word, vars, nvars);
+        append_split(&buf, expanded);
+        free(expanded);
+    }
+
+    if (buf.count == 0) {
+        return; // nothing but empty placeholders, left to the shell
+    }
+
+    // the argv and its strings are freed together
+    cmd->argv = xmalloc((buf.count + 1) * sizeof(char *) + buf.len);
+    char *args = (char *)(cmd->argv + buf.count + 1);
+    memcpy(args, buf.data, buf.len);
+    for (size_t i = 0; i < buf.count; ++i) {
+        cmd->argv[i] = args;
+        args += strlen(args) + 1;
+    }
+    cmd->argv[buf.count] = NULL;
+    free(buf.data);
+}
+
+void command_set_label(struct command *cmd, const char *label) {
+    free(cmd->label);
+    cmd->label = xstrdup(label);
+}
+
+void command_free(struct command *cmd) {
+    free(cmd->line);
+    free(cmd->argv);
+    free(cmd->label);
+    cmd->line = NULL;
+    cmd->argv = NULL;
+    cmd->label = NULL;
+}
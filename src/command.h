@@ -0,0 +1,56 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2025 Josh Simonot
+ */
+
+#ifndef _COMMAND_H_
+#define _COMMAND_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Build commands, started without a shell whenever possible.
+//
+// A template is a command from the config with only the per file
+// placeholders left ([SRCPATH], [OBJPATH], [OBJS], ...). It is split
+// into words once per target, every command expanded from it then only
+// substitutes the placeholders of the words that have any, and is
+// started directly from the resulting argv.
+//
+// Templates using shell syntax (quotes, pipes, redirections, shell
+// variables, globs, ...) run through /bin/sh like before.
+
+struct command_template {
+    char *text;   // the template as configured
+    bool shell;   // uses shell syntax, runs through /bin/sh
+    size_t argc;
+    char **argv;  // words of the template, placeholders not expanded
+};
+
+// a placeholder, like "[OBJPATH]", and its value, the value of a word
+// is split on spaces like the shell would, which is how [OBJS] and
+// other lists expand to several arguments
+struct command_var {
+    const char *name;
+    const char *value;
+};
+
+struct command {
+    char *line;   // the expanded command line, echoed and hashed
+    char **argv;  // NULL when the command runs through the shell
+    char *label;  // what it builds, shown on the progress line, or NULL
+};
+
+void command_template_init(struct command_template *tpl, const char *text);
+void command_template_free(struct command_template *tpl);
+
+// the line is the template with every placeholder replaced, exactly
+// like replacing them one after another in the text would
+void command_expand(const struct command_template *tpl, const struct command_var *vars, size_t nvars, struct command *cmd);
+void command_set_label(struct command *cmd, const char *label);
+void command_free(struct command *cmd);
+
+#endif // _COMMAND_H_
@@ -0,0 +1,903 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2025 Josh Simonot
+ */
+
+#include "depdb.h"
+
+#include "libcc/cc_hash.h"
+#include "vendor/cwalk/cwalk.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEPDB_MAGIC "ccbuild-depdb"
+#define DEPDB_VERSION 7
+
+static char* arena_strdup(struct cc_arena *arena, const char *str) {
+    size_t len = strlen(str);
+    char *dup = cc_alloc(arena, len + 1);
+    if (dup != NULL) {
+        memcpy(dup, str, len + 1);
+    }
+    return dup;
+}
+
+// splits the next tab separated field off the line,
+// also strips the trailing newline from the last field
+static char* next_field(char **line) {
+    char *field = *line;
+    if (field == NULL) {
+        return NULL;
+    }
+    char *end = strpbrk(field, "\t\n");
+    if (end == NULL) {
+        *line = NULL;
+    } else if (*end == '\n') {
+        *end = 0;
+        *line = NULL;
+    } else {
+        *end = 0;
+        *line = end + 1;
+    }
+    return field;
+}
+
+// reads a whole line however long it is, reverse index lines of
+// widely included headers easily exceed any fixed size buffer
+static char* read_line(FILE *file, char **buf, size_t *cap) {
+    size_t len = 0;
+    for (;;) {
+        if (*cap - len < 2) {
+            *cap = *cap ? 2 * *cap : 4096;
+            *buf = realloc(*buf, *cap);
+            if (*buf == NULL) {
+                printf("%s: out of memory\n", __func__);
+                abort();
+            }
+        }
+        if (!fgets(*buf + len, *cap - len, file)) {
+            return (len > 0) ? *buf : NULL;
+        }
+        len += strlen(*buf + len);
+        if ((*buf)[len - 1] == '\n') {
+            return *buf;
+        }
+    }
+}
+
+// parses a space separated list of ids, each must be below limit
+static bool parse_ids(char *field, size_t *ids, size_t count, size_t limit) {
+    char *itr = field;
+    for (size_t i = 0; i < count; ++i) {
+        char *end;
+        unsigned long long id = strtoull(itr, &end, 10);
+        if (end == itr || id >= limit) {
+            return false;
+        }
+        ids[i] = id;
+        itr = end;
+    }
+    return true;
+}
+
+// makes room for one more item, doubling the capacity when full
+static void* grow_array(void *items, size_t count, size_t *cap, size_t itemsize) {
+    if (count < *cap) {
+        return items;
+    }
+    *cap = *cap ? 2 * *cap : 64;
+    items = realloc(items, *cap * itemsize);
+    if (items == NULL) {
+        printf("%s: out of memory\n", __func__);
+        abort();
+    }
+    return items;
+}
+
+static void depdb_init(struct depdb *db, const char *path) {
+    memset(db, 0, sizeof *db);
+    pthread_mutex_init(&db->lock, NULL);
+    pthread_cond_init(&db->scanned, NULL);
+    db->arena = cc_new_arena_calloc_wrapper();
+    db->files.arena = db->arena;
+    db->tus.arena = db->arena;
+    db->links.arena = db->arena;
+    ccstrcpy_raw(&db->path, path);
+}
+
+// find or insert, caller must hold the lock
+static struct depdb_file* depdb_file_locked(struct depdb *db, const char *path) {
+    struct depdb_file *file = cc_trie_search(&db->files, CC_TRIE_STR_KEY(path));
+    if (file == NULL) {
+        file = cc_alloc(db->arena, sizeof *file);
+        file->path = arena_strdup(db->arena, path);
+        cc_trie_insert(&db->files, CC_TRIE_STR_KEY(path), file);
+    }
+    return file;
+}
+
+// find or insert, caller must hold the lock
+static struct depdb_link* depdb_link_locked(struct depdb *db, const char *outpath) {
+    struct depdb_link *link = cc_trie_search(&db->links, CC_TRIE_STR_KEY(outpath));
+    if (link == NULL) {
+        link = cc_alloc(db->arena, sizeof *link);
+        link->outpath = arena_strdup(db->arena, outpath);
+        cc_trie_insert(&db->links, CC_TRIE_STR_KEY(outpath), link);
+    }
+    return link;
+}
+
+// find or insert, caller must hold the lock
+static struct depdb_tu* depdb_tu_locked(struct depdb *db, const char *srcpath) {
+    struct depdb_tu *tu = cc_trie_search(&db->tus, CC_TRIE_STR_KEY(srcpath));
+    if (tu == NULL) {
+        tu = cc_alloc(db->arena, sizeof *tu);
+        tu->src = depdb_file_locked(db, srcpath);
+        cc_trie_insert(&db->tus, CC_TRIE_STR_KEY(srcpath), tu);
+    }
+    return tu;
+}
+
+int depdb_load(struct depdb *db, const char *path) {
+    depdb_init(db, path);
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return 0; // first build
+    }
+    char *line = NULL;
+    size_t linecap = 0;
+    int version = 0;
+
+    if (!read_line(file, &line, &linecap)
+        || sscanf(line, DEPDB_MAGIC " %d", &version) != 1
+        || version != DEPDB_VERSION) {
+        printf("INFO: ignoring incompatible dependency database '%s'\n", path);
+        free(line);
+        fclose(file);
+        return 0;
+    }
+
+    struct depdb_tu *tu = NULL;
+    struct depdb_link *link = NULL;
+    size_t nmembers = 0;
+    size_t *ids = NULL;
+    size_t filecap = 0;
+    size_t tucap = 0;
+
+    while (read_line(file, &line, &linecap)) {
+        char *itr = line;
+        char *tag = next_field(&itr);
+
+        if (strcmp(tag, "L") == 0) {
+            char *duration = next_field(&itr);
+            if (duration == NULL) goto corrupt;
+            db->recorded_link_ns = strtoull(duration, NULL, 10);
+
+        } else if (strcmp(tag, "O") == 0) {
+            char *fingerprint = next_field(&itr);
+            char *mtime = next_field(&itr);
+            char *size = next_field(&itr);
+            char *inode = next_field(&itr);
+            char *count = next_field(&itr);
+            char *outpath = next_field(&itr);
+            if (outpath == NULL || link != NULL) goto corrupt;
+
+            link = depdb_link_locked(db, outpath);
+            link->fingerprint = strtoull(fingerprint, NULL, 16);
+            link->output.mtime_ns = strtoll(mtime, NULL, 10);
+            link->output.size = strtoll(size, NULL, 10);
+            link->output.inode = strtoull(inode, NULL, 10);
+            link->nmembers = strtoul(count, NULL, 10);
+            link->members = cc_alloc(db->arena, (link->nmembers + 1) * sizeof *link->members);
+            nmembers = 0;
+            if (link->nmembers == 0) {
+                link = NULL;
+            }
+
+        } else if (strcmp(tag, "M") == 0) {
+            // members of the preceding static library
+            char *mtime = next_field(&itr);
+            char *size = next_field(&itr);
+            char *inode = next_field(&itr);
+            char *objpath = next_field(&itr);
+            if (objpath == NULL || link == NULL) goto corrupt;
+
+            struct depdb_member *member = &link->members[nmembers++];
+            member->objpath = arena_strdup(db->arena, objpath);
+            member->stamp.mtime_ns = strtoll(mtime, NULL, 10);
+            member->stamp.size = strtoll(size, NULL, 10);
+            member->stamp.inode = strtoull(inode, NULL, 10);
+            if (nmembers == link->nmembers) {
+                link = NULL;
+            }
+
+        } else if (strcmp(tag, "F") == 0) {
+            char *mtime = next_field(&itr);
+            char *size = next_field(&itr);
+            char *inode = next_field(&itr);
+            char *hash = next_field(&itr);
+            char *fpath = next_field(&itr);
+            if (fpath == NULL) goto corrupt;
+
+            struct depdb_file *f = depdb_file_locked(db, fpath);
+            f->recorded.mtime_ns = strtoll(mtime, NULL, 10);
+            f->recorded.size = strtoll(size, NULL, 10);
+            f->recorded.inode = strtoull(inode, NULL, 10);
+            f->recorded_hash = strtoull(hash, NULL, 16);
+            f->known = true;
+            f->id = db->nfiles;
+            db->files_by_id = grow_array(db->files_by_id, db->nfiles, &filecap, sizeof *db->files_by_id);
+            db->files_by_id[db->nfiles++] = f;
+
+        } else if (strcmp(tag, "T") == 0) {
+            char *main_file = next_field(&itr);
+            char *depfile = next_field(&itr);
+            char *built = next_field(&itr);
+            char *cmdhash = next_field(&itr);
+            char *duration = next_field(&itr);
+            char *count = next_field(&itr);
+            char *srcpath = next_field(&itr);
+            char *objpath = next_field(&itr);
+            if (objpath == NULL || tu != NULL) goto corrupt;
+
+            tu = depdb_tu_locked(db, srcpath);
+            tu->main_file = (strcmp(main_file, "1") == 0);
+            tu->depfile = (strcmp(depfile, "1") == 0);
+            tu->built = (strcmp(built, "1") == 0);
+            tu->cmdhash = strtoull(cmdhash, NULL, 16);
+            tu->duration_ns = strtoull(duration, NULL, 10);
+            tu->objpath = arena_strdup(db->arena, objpath);
+            tu->nheaders = strtoul(count, NULL, 10);
+            tu->headers = cc_alloc(db->arena, (tu->nheaders + 1) * sizeof *tu->headers);
+            tu->indexed = true;
+            tu->id = db->ntus;
+            db->tus_by_id = grow_array(db->tus_by_id, db->ntus, &tucap, sizeof *db->tus_by_id);
+            db->tus_by_id[db->ntus++] = tu;
+
+        } else if (strcmp(tag, "H") == 0) {
+            // header ids of the preceding translation unit
+            char *list = next_field(&itr);
+            if (tu == NULL || list == NULL) goto corrupt;
+
+            ids = realloc(ids, (tu->nheaders + 1) * sizeof *ids);
+            if (!parse_ids(list, ids, tu->nheaders, db->nfiles)) goto corrupt;
+            for (size_t i = 0; i < tu->nheaders; ++i) {
+                tu->headers[i] = db->files_by_id[ids[i]];
+            }
+            tu = NULL;
+
+        } else if (strcmp(tag, "R") == 0) {
+            // translation unit ids that depend on a file
+            char *fileid = next_field(&itr);
+            char *count = next_field(&itr);
+            char *list = next_field(&itr);
+            if (list == NULL || tu != NULL) goto corrupt;
+
+            size_t id = strtoull(fileid, NULL, 10);
+            if (id >= db->nfiles) goto corrupt;
+
+            struct depdb_file *f = db->files_by_id[id];
+            f->ndependents = strtoul(count, NULL, 10);
+            f->dependents = cc_alloc(db->arena, (f->ndependents + 1) * sizeof *f->dependents);
+            if (!parse_ids(list, f->dependents, f->ndependents, db->ntus)) goto corrupt;
+
+        } else {
+            goto corrupt;
+        }
+    }
+    if (tu != NULL) goto corrupt; // missing header list
+    if (link != NULL) goto corrupt; // missing members
+
+    free(ids);
+    free(line);
+    fclose(file);
+    return 0;
+
+corrupt:
+    printf("INFO: ignoring corrupt dependency database '%s'\n", path);
+    free(ids);
+    free(line);
+    fclose(file);
+    depdb_free(db);
+    depdb_init(db, path);
+    return 0;
+}
+
+static int mark_referenced_cb(void *ctx, void *data) {
+    struct depdb_tu *tu = data;
+    (void)ctx;
+    if (!tu->seen) {
+        return 0;
+    }
+    tu->src->referenced = true;
+    for (size_t i = 0; i < tu->nheaders; ++i) {
+        tu->headers[i]->referenced = true;
+    }
+    return 0;
+}
+
+// numbers the files and translation units as they are written,
+// and collects (file, translation unit) pairs for the reverse index
+struct save_ctx {
+    FILE *file;
+    size_t nfiles;
+    size_t ntus;
+    size_t (*edges)[2];
+    size_t nedges;
+    size_t edgecap;
+};
+
+static void push_edge(struct save_ctx *ctx, size_t fileid, size_t tuid) {
+    if (ctx->nedges == ctx->edgecap) {
+        ctx->edgecap = ctx->edgecap ? 2 * ctx->edgecap : 256;
+        ctx->edges = realloc(ctx->edges, ctx->edgecap * sizeof *ctx->edges);
+        if (ctx->edges == NULL) {
+            printf("%s: out of memory\n", __func__);
+            abort();
+        }
+    }
+    ctx->edges[ctx->nedges][0] = fileid;
+    ctx->edges[ctx->nedges][1] = tuid;
+    ctx->nedges++;
+}
+
+static int write_file_cb(void *ctx, void *data) {
+    struct save_ctx *save = ctx;
+    struct depdb_file *f = data;
+    if (!f->referenced) {
+        return 0;
+    }
+    f->id = save->nfiles++;
+
+    struct ccfs_stamp stamp = f->statted ? f->current : f->recorded;
+    uint64_t hash = f->statted ? f->current_hash : f->recorded_hash;
+    fprintf(save->file, "F\t%" PRId64 "\t%" PRId64 "\t%" PRIu64 "\t%016" PRIx64 "\t%s\n",
+            stamp.mtime_ns, stamp.size, stamp.inode, hash, f->path);
+    return 0;
+}
+
+static int write_tu_cb(void *ctx, void *data) {
+    struct save_ctx *save = ctx;
+    struct depdb_tu *tu = data;
+    if (!tu->seen) {
+        return 0;
+    }
+    size_t id = save->ntus++;
+
+    fprintf(save->file, "T\t%d\t%d\t%d\t%016" PRIx64 "\t%" PRIu64 "\t%zu\t%s\t%s\nH\t", tu->main_file,
+            tu->depfile, tu->built, tu->cmdhash, tu->duration_ns, tu->nheaders, tu->src->path, tu->objpath);
+    push_edge(save, tu->src->id, id);
+    for (size_t i = 0; i < tu->nheaders; ++i) {
+        fprintf(save->file, (i == 0) ? "%zu" : " %zu", tu->headers[i]->id);
+        push_edge(save, tu->headers[i]->id, id);
+    }
+    fputc('\n', save->file);
+    return 0;
+}
+
+static int write_link_cb(void *ctx, void *data) {
+    struct save_ctx *save = ctx;
+    struct depdb_link *link = data;
+    if (!link->seen) {
+        return 0;
+    }
+    fprintf(save->file, "O\t%016" PRIx64 "\t%" PRId64 "\t%" PRId64 "\t%" PRIu64 "\t%zu\t%s\n", link->fingerprint,
+            link->output.mtime_ns, link->output.size, link->output.inode, link->nmembers, link->outpath);
+    for (size_t i = 0; i < link->nmembers; ++i) {
+        struct depdb_member *member = &link->members[i];
+        fprintf(save->file, "M\t%" PRId64 "\t%" PRId64 "\t%" PRIu64 "\t%s\n",
+                member->stamp.mtime_ns, member->stamp.size, member->stamp.inode, member->objpath);
+    }
+    return 0;
+}
+
+// inverts the collected pairs with a counting sort by file id, which
+// keeps the translation unit ids of each file in ascending order
+static void write_reverse_index(struct save_ctx *save) {
+    size_t *offsets = calloc(save->nfiles + 1, sizeof *offsets);
+    size_t *tuids = malloc((save->nedges + 1) * sizeof *tuids);
+    if (offsets == NULL || tuids == NULL) {
+        printf("%s: out of memory\n", __func__);
+        abort();
+    }
+    for (size_t i = 0; i < save->nedges; ++i) {
+        offsets[save->edges[i][0] + 1]++;
+    }
+    for (size_t i = 0; i < save->nfiles; ++i) {
+        offsets[i + 1] += offsets[i];
+    }
+    for (size_t i = 0; i < save->nedges; ++i) {
+        tuids[offsets[save->edges[i][0]]++] = save->edges[i][1];
+    }
+
+    // offsets[i] now marks the end of file i
+    size_t begin = 0;
+    for (size_t i = 0; i < save->nfiles; ++i) {
+        fprintf(save->file, "R\t%zu\t%zu\t", i, offsets[i] - begin);
+        for (size_t j = begin; j < offsets[i]; ++j) {
+            fprintf(save->file, (j == begin) ? "%zu" : " %zu", tuids[j]);
+        }
+        fputc('\n', save->file);
+        begin = offsets[i];
+    }
+    free(offsets);
+    free(tuids);
+}
+
+int depdb_save(struct depdb *db) {
+    assert(db->arena != NULL);
+
+    size_t dirname_len;
+    cwk_path_get_dirname(db->path.cstr, &dirname_len);
+
+    char dirpath[PATH_MAX];
+    snprintf(dirpath, sizeof dirpath, "%.*s", (int)dirname_len, db->path.cstr);
+    ccfs_mkdirp(dirpath);
+
+    // write to a temporary file first so an interrupted
+    // build never leaves a truncated database behind
+    char tmppath[PATH_MAX];
+    snprintf(tmppath, sizeof tmppath, "%s.tmp", db->path.cstr);
+
+    FILE *file = fopen(tmppath, "w");
+    if (file == NULL) {
+        printf("error: failed to write dependency database '%s'\n", tmppath);
+        return -1;
+    }
+    fprintf(file, DEPDB_MAGIC " %d\n", DEPDB_VERSION);
+
+    struct save_ctx save = { .file = file };
+
+    pthread_mutex_lock(&db->lock);
+    uint64_t link_ns = db->current_link_ns ? db->current_link_ns : db->recorded_link_ns;
+    fprintf(file, "L\t%" PRIu64 "\n", link_ns);
+    cc_trie_iterate(&db->tus, NULL, mark_referenced_cb);
+    cc_trie_iterate(&db->files, &save, write_file_cb);
+    cc_trie_iterate(&db->tus, &save, write_tu_cb);
+    write_reverse_index(&save);
+    cc_trie_iterate(&db->links, &save, write_link_cb);
+    pthread_mutex_unlock(&db->lock);
+    free(save.edges);
+
+    if (fclose(file) != 0 || rename(tmppath, db->path.cstr) != 0) {
+        printf("error: failed to write dependency database '%s'\n", db->path.cstr);
+        return -1;
+    }
+    return 0;
+}
+
+void depdb_free(struct depdb *db) {
+    if (db->arena != NULL) {
+        cc_destroy_arena_calloc_wrapper(db->arena);
+    }
+    free(db->files_by_id);
+    free(db->tus_by_id);
+    free(db->dirty);
+    pthread_mutex_destroy(&db->lock);
+    pthread_cond_destroy(&db->scanned);
+    ccstr_free(&db->path);
+    memset(db, 0, sizeof *db);
+}
+
+struct depdb_file* depdb_file(struct depdb *db, const char *path) {
+    pthread_mutex_lock(&db->lock);
+    struct depdb_file *file = depdb_file_locked(db, path);
+    pthread_mutex_unlock(&db->lock);
+    return file;
+}
+
+static bool same_stamp(const struct ccfs_stamp *a, const struct ccfs_stamp *b) {
+    return a->mtime_ns == b->mtime_ns
+        && a->size == b->size
+        && a->inode == b->inode;
+}
+
+static int hash_file(const char *path, uint64_t *hash) {
+    ccstrview contents;
+    if (ccfs_map_readonly(path, &contents) != 0) {
+        return -1;
+    }
+    *hash = cc_hash64(contents.cstr, contents.len, 0);
+    ccfs_unmap(&contents);
+    return 0;
+}
+
+bool depdb_file_changed(struct depdb *db, struct depdb_file *file) {
+    pthread_mutex_lock(&db->lock);
+    bool statted = file->statted;
+    pthread_mutex_unlock(&db->lock);
+
+    if (!statted) {
+        // stat outside the lock, racing threads
+        // will both observe the same stamp
+        struct ccfs_stamp stamp;
+        ccfs_file_stamp(file->path, &stamp);
+
+        // only read the contents when the cheap stamp says it
+        // may have changed, the hash is kept for the next build
+        uint64_t hash = file->recorded_hash;
+        if (!file->known || !same_stamp(&stamp, &file->recorded)) {
+            if (stamp.size == -1 || hash_file(file->path, &hash) != 0) {
+                hash = 0;
+            }
+        }
+
+        pthread_mutex_lock(&db->lock);
+        file->current = stamp;
+        file->current_hash = hash;
+        file->statted = true;
+        pthread_mutex_unlock(&db->lock);
+    }
+    return !file->known
+        || file->current.size != file->recorded.size
+        || file->current_hash != file->recorded_hash;
+}
+
+void depdb_mark_dirty(struct depdb *db) {
+    size_t nwords = (db->ntus + 63) / 64;
+    db->dirty = calloc(nwords + 1, sizeof *db->dirty);
+    if (db->dirty == NULL) {
+        printf("%s: out of memory\n", __func__);
+        abort();
+    }
+    db->nchanged = 0;
+    db->ndirty = 0;
+
+    for (size_t i = 0; i < db->nfiles; ++i) {
+        struct depdb_file *file = db->files_by_id[i];
+        if (!depdb_file_changed(db, file)) {
+            continue;
+        }
+        db->nchanged++;
+        for (size_t j = 0; j < file->ndependents; ++j) {
+            size_t id = file->dependents[j];
+            uint64_t bit = UINT64_C(1) << (id % 64);
+            if (!(db->dirty[id / 64] & bit)) {
+                db->dirty[id / 64] |= bit;
+                db->ndirty++;
+            }
+        }
+    }
+}
+
+bool depdb_tu_dirty(const struct depdb *db, const struct depdb_tu *tu) {
+    if (!tu->indexed || db->dirty == NULL) {
+        return true;
+    }
+    return (db->dirty[tu->id / 64] >> (tu->id % 64)) & 1;
+}
+
+struct depdb_tu* depdb_find_tu(struct depdb *db, const char *srcpath) {
+    pthread_mutex_lock(&db->lock);
+    struct depdb_tu *tu = cc_trie_search(&db->tus, CC_TRIE_STR_KEY(srcpath));
+    pthread_mutex_unlock(&db->lock);
+    return tu;
+}
+
+struct depdb_tu* depdb_update_tu(struct depdb *db, const char *srcpath, const char *objpath,
+                                 bool main_file, struct depdb_file **headers, size_t nheaders, bool depfile) {
+    pthread_mutex_lock(&db->lock);
+    struct depdb_tu *tu = depdb_tu_locked(db, srcpath);
+
+    tu->main_file = main_file;
+    tu->depfile = depfile;
+    tu->objpath = arena_strdup(db->arena, objpath);
+    tu->headers = cc_alloc(db->arena, (nheaders + 1) * sizeof *tu->headers);
+    memcpy(tu->headers, headers, nheaders * sizeof *headers);
+    tu->nheaders = nheaders;
+    tu->built = false;
+    tu->seen = true;
+
+    pthread_mutex_unlock(&db->lock);
+    return tu;
+}
+
+void depdb_keep_tu(struct depdb *db, struct depdb_tu *tu) {
+    pthread_mutex_lock(&db->lock);
+    tu->seen = true;
+    pthread_mutex_unlock(&db->lock);
+}
+
+void depdb_set_main_file(struct depdb *db, struct depdb_tu *tu, bool main_file) {
+    pthread_mutex_lock(&db->lock);
+    tu->main_file = main_file;
+    pthread_mutex_unlock(&db->lock);
+}
+
+void depdb_set_built(struct depdb *db, struct depdb_tu *tu, bool built, uint64_t cmdhash) {
+    pthread_mutex_lock(&db->lock);
+    tu->built = built;
+    tu->cmdhash = cmdhash;
+    tu->seen = true;
+    pthread_mutex_unlock(&db->lock);
+}
+
+void depdb_set_duration(struct depdb *db, struct depdb_tu *tu, uint64_t duration_ns) {
+    pthread_mutex_lock(&db->lock);
+    tu->duration_ns = duration_ns;
+    pthread_mutex_unlock(&db->lock);
+}
+
+void depdb_set_link_duration(struct depdb *db, uint64_t duration_ns) {
+    pthread_mutex_lock(&db->lock);
+    if (duration_ns > db->current_link_ns) {
+        db->current_link_ns = duration_ns;
+    }
+    pthread_mutex_unlock(&db->lock);
+}
+
+struct depdb_link* depdb_find_link(struct depdb *db, const char *outpath) {
+    pthread_mutex_lock(&db->lock);
+    struct depdb_link *link = cc_trie_search(&db->links, CC_TRIE_STR_KEY(outpath));
+    pthread_mutex_unlock(&db->lock);
+    return link;
+}
+
+struct outputs_ctx {
+    size_t count;
+    bool unchanged;
+};
+
+static int check_output_cb(void *ctx, void *data) {
+    struct outputs_ctx *outputs = ctx;
+    struct depdb_link *link = data;
+    struct ccfs_stamp stamp;
+    outputs->count++;
+    if (ccfs_file_stamp(link->outpath, &stamp) != 0 || stamp.mtime_ns != link->output.mtime_ns
+        || stamp.size != link->output.size || stamp.inode != link->output.inode) {
+        outputs->unchanged = false;
+    }
+    return 0;
+}
+
+bool depdb_outputs_unchanged(struct depdb *db) {
+    struct outputs_ctx outputs = { .unchanged = true };
+    pthread_mutex_lock(&db->lock);
+    cc_trie_iterate(&db->links, &outputs, check_output_cb);
+    pthread_mutex_unlock(&db->lock);
+    return outputs.count > 0 && outputs.unchanged;
+}
+
+void depdb_keep_link(struct depdb *db, struct depdb_link *link) {
+    pthread_mutex_lock(&db->lock);
+    link->seen = true;
+    pthread_mutex_unlock(&db->lock);
+}
+
+void depdb_set_link(struct depdb *db, const char *outpath, uint64_t fingerprint, const struct ccfs_stamp *output,
+                    char **members, const struct ccfs_stamp *stamps, size_t nmembers) {
+    pthread_mutex_lock(&db->lock);
+    struct depdb_link *link = depdb_link_locked(db, outpath);
+    link->fingerprint = fingerprint;
+    link->output = *output;
+    link->members = cc_alloc(db->arena, (nmembers + 1) * sizeof *link->members);
+    link->nmembers = nmembers;
+    for (size_t i = 0; i < nmembers; ++i) {
+        link->members[i].objpath = arena_strdup(db->arena, members[i]);
+        link->members[i].stamp = stamps[i];
+    }
+    link->seen = true;
+    pthread_mutex_unlock(&db->lock);
+}
+
+bool depdb_claim_scan(struct depdb *db, struct depdb_file *file) {
+    pthread_mutex_lock(&db->lock);
+    if (file->scan_state == DEPDB_UNSCANNED) {
+        file->scan_state = DEPDB_SCANNING;
+        pthread_mutex_unlock(&db->lock);
+        return true;
+    }
+    while (file->scan_state == DEPDB_SCANNING) {
+        pthread_cond_wait(&db->scanned, &db->lock);
+    }
+    pthread_mutex_unlock(&db->lock);
+    return false;
+}
+
+void depdb_set_includes(struct depdb *db, struct depdb_file *file, struct depdb_file **includes, size_t count) {
+    pthread_mutex_lock(&db->lock);
+    assert(file->scan_state == DEPDB_SCANNING);
+
+    file->includes = cc_alloc(db->arena, (count + 1) * sizeof *includes);
+    memcpy(file->includes, includes, count * sizeof *includes);
+    file->nincludes = count;
+    file->scan_state = DEPDB_SCANNED;
+
+    pthread_cond_broadcast(&db->scanned);
+    pthread_mutex_unlock(&db->lock);
+}
+
+static void push_file(struct depdb_file ***items, size_t *count, size_t *cap, struct depdb_file *file) {
+    if (*count == *cap) {
+        *cap = *cap ? 2 * *cap : 32;
+        *items = realloc(*items, *cap * sizeof **items);
+        if (*items == NULL) {
+            printf("%s: out of memory\n", __func__);
+            abort();
+        }
+    }
+    (*items)[(*count)++] = file;
+}
+
+// state of one closure computation, the lock is held throughout
+struct closure_ctx {
+    struct depdb *db;
+    struct depdb_closure *out;
+    struct depdb_file **stack;
+    size_t depth;
+    size_t stackcap;
+    unsigned visit;
+    unsigned mark;
+    int index;
+};
+
+// appends the file to dest unless it is already there, the
+// mark generation makes this O(1) without a separate set
+static void union_file(struct closure_ctx *ctx, struct depdb_file ***dest, size_t *count, size_t *cap, struct depdb_file *file) {
+    if (file->mark != ctx->mark) {
+        file->mark = ctx->mark;
+        push_file(dest, count, cap, file);
+    }
+}
+
+// assigns the closure to every member of a strongly connected component,
+// which is a single header unless there is an include cycle
+static void finish_component(struct closure_ctx *ctx, struct depdb_file *root) {
+    struct depdb *db = ctx->db;
+
+    size_t first = ctx->depth;
+    do {
+        --first;
+    } while (ctx->stack[first] != root);
+
+    size_t nmembers = ctx->depth - first;
+    bool incomplete = false;
+    for (size_t i = first; i < ctx->depth; ++i) {
+        ctx->stack[i]->onstack = false;
+        incomplete |= ctx->stack[i]->incomplete;
+    }
+    if (incomplete) {
+        // some reachable header has not been scanned yet, members
+        // will be revisited when the query is repeated
+        ctx->depth = first;
+        return;
+    }
+    bool self_include = false;
+    for (size_t j = 0; j < root->nincludes; ++j) {
+        self_include |= (root->includes[j] == root);
+    }
+    if (nmembers > 1 || self_include) {
+        ++db->include_cycles;
+        printf("INFO: include cycle detected at '%s'\n", root->path);
+    }
+
+    struct depdb_file **closure = NULL;
+    size_t count = 0, cap = 0;
+    int64_t mtime = -1;
+
+    ctx->mark = ++db->generation;
+    for (size_t i = first; i < ctx->depth; ++i) {
+        struct depdb_file *member = ctx->stack[i];
+        union_file(ctx, &closure, &count, &cap, member);
+
+        for (size_t j = 0; j < member->nincludes; ++j) {
+            struct depdb_file *inc = member->includes[j];
+            if (!inc->closure_done) {
+                continue; // member of this component
+            }
+            for (size_t k = 0; k < inc->nclosure; ++k) {
+                union_file(ctx, &closure, &count, &cap, inc->closure[k]);
+            }
+        }
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (closure[i]->current.mtime_ns > mtime) {
+            mtime = closure[i]->current.mtime_ns;
+        }
+    }
+
+    struct depdb_file **stored = cc_alloc(db->arena, (count + 1) * sizeof *stored);
+    memcpy(stored, closure, count * sizeof *stored);
+    free(closure);
+
+    for (size_t i = first; i < ctx->depth; ++i) {
+        struct depdb_file *member = ctx->stack[i];
+        member->closure = stored;
+        member->nclosure = count;
+        member->closure_mtime = mtime;
+        member->closure_done = true;
+    }
+    ctx->depth = first;
+}
+
+// Tarjan's strongly connected components, so headers that include
+// each other share one closure instead of recursing forever
+static void visit_header(struct closure_ctx *ctx, struct depdb_file *file) {
+    file->visit = ctx->visit;
+    file->index = file->lowlink = ctx->index++;
+    file->incomplete = false;
+    file->onstack = true;
+    push_file(&ctx->stack, &ctx->depth, &ctx->stackcap, file);
+
+    if (file->scan_state != DEPDB_SCANNED) {
+        struct depdb_closure *out = ctx->out;
+        push_file(&out->pending, &out->npending, &out->pendingcap, file);
+        file->incomplete = true;
+    }
+
+    for (size_t i = 0; i < file->nincludes; ++i) {
+        struct depdb_file *inc = file->includes[i];
+        if (inc->closure_done) {
+            continue;
+        }
+        if (inc->visit != ctx->visit) {
+            visit_header(ctx, inc);
+            if (inc->lowlink < file->lowlink) file->lowlink = inc->lowlink;
+            file->incomplete |= inc->incomplete;
+
+        } else if (inc->onstack) {
+            if (inc->index < file->lowlink) file->lowlink = inc->index;
+
+        } else {
+            // visited during this query but left unfinished
+            file->incomplete = true;
+        }
+    }
+    if (file->lowlink == file->index) {
+        finish_component(ctx, file);
+    }
+}
+
+size_t depdb_header_closure(struct depdb *db, struct depdb_file **roots, size_t nroots, struct depdb_closure *out) {
+    out->count = 0;
+    out->npending = 0;
+    out->mtime = -1;
+
+    pthread_mutex_lock(&db->lock);
+
+    struct closure_ctx ctx = {
+        .db = db,
+        .out = out,
+        .visit = ++db->generation,
+    };
+    for (size_t i = 0; i < nroots; ++i) {
+        if (!roots[i]->closure_done && roots[i]->visit != ctx.visit) {
+            visit_header(&ctx, roots[i]);
+        }
+    }
+    free(ctx.stack);
+
+    if (out->npending == 0) {
+        unsigned mark = ++db->generation;
+        for (size_t i = 0; i < nroots; ++i) {
+            struct depdb_file *root = roots[i];
+            for (size_t k = 0; k < root->nclosure; ++k) {
+                struct depdb_file *header = root->closure[k];
+                if (header->mark != mark) {
+                    header->mark = mark;
+                    push_file(&out->headers, &out->count, &out->cap, header);
+                }
+            }
+            if (root->closure_mtime > out->mtime) {
+                out->mtime = root->closure_mtime;
+            }
+        }
+    }
+    pthread_mutex_unlock(&db->lock);
+    return out->npending;
+}
+
+void depdb_closure_free(struct depdb_closure *closure) {
+    free(closure->headers);
+    free(closure->pending);
+    memset(closure, 0, sizeof *closure);
+}
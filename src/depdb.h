@@ -0,0 +1,230 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2025 Josh Simonot
+ */
+
+#ifndef _DEPDB_H_
+#define _DEPDB_H_
+
+#include "libcc/cc_allocator.h"
+#include "libcc/cc_files.h"
+#include "libcc/cc_strings.h"
+#include "libcc/cc_trie_map.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The dependency database persists what was learned about each
+// translation unit during the previous build (which headers it
+// includes, whether it has an entry point, where its obj goes)
+// so the next build only has to re-read files that changed, and
+// how long each compile took so it can schedule the slow ones first.
+//
+// Files are compared by a cheap stamp (mtime, size, inode) first,
+// the contents are only hashed when the stamp differs. A file that
+// was touched but whose contents are the same is not a change.
+//
+// Files and translation units are numbered when saved, and the
+// database keeps the reverse index (file -> translation units that
+// depend on it) next to the forward one. Finding the dirty units is
+// one stat per recorded file, then setting bits only for the units
+// of the files that actually changed.
+//
+// Each executable and library records a fingerprint of its inputs
+// and link command, and the stamp it had right after the link, so a
+// build that changed none of them does not link it again.
+
+enum depdb_scan_state {
+    DEPDB_UNSCANNED = 0,
+    DEPDB_SCANNING,
+    DEPDB_SCANNED,
+};
+
+// any file the build depends on, source or header
+struct depdb_file {
+    char *path;
+    struct ccfs_stamp recorded; // stamp as of the previous build
+    struct ccfs_stamp current;  // stamp observed during this build
+    uint64_t recorded_hash;     // contents hash as of the previous build
+    uint64_t current_hash;      // contents hash observed during this build
+    bool known;                 // was recorded by the previous build
+    bool statted;               // current stamp is valid
+    bool referenced;            // used while saving
+
+    // reverse index as of the previous build, ids of
+    // the translation units that depend on this file
+    size_t id;
+    size_t *dependents;
+    size_t ndependents;
+
+    // per build memo of the include scan, each header is read
+    // at most once and its transitive closure is computed once
+    enum depdb_scan_state scan_state;
+    struct depdb_file **includes;
+    size_t nincludes;
+    struct depdb_file **closure;
+    size_t nclosure;
+    int64_t closure_mtime;
+    bool closure_done;
+
+    // scratch space for the closure computation (guarded by lock)
+    unsigned visit;
+    unsigned mark;
+    int index;
+    int lowlink;
+    bool onstack;
+    bool incomplete;
+};
+
+// result of a header closure query
+struct depdb_closure {
+    struct depdb_file **headers;
+    size_t count;
+    size_t cap;
+    int64_t mtime; // newest mtime_ns of the headers
+
+    // headers that must be scanned before the query can complete
+    struct depdb_file **pending;
+    size_t npending;
+    size_t pendingcap;
+};
+
+struct depdb_tu {
+    struct depdb_file *src;
+    char *objpath;
+    struct depdb_file **headers;
+    size_t nheaders;
+    bool main_file;
+    bool depfile; // headers were reported by the compiler
+    bool built;   // obj was successfully built from the recorded inputs
+    uint64_t cmdhash; // hash of the fully expanded compile command
+    uint64_t duration_ns; // wall time of the last successful compile, 0 if unknown
+    bool seen;    // visited during this build
+    bool indexed; // loaded from the database, id is valid
+    size_t id;
+};
+
+// an obj archived into a static library
+struct depdb_member {
+    char *objpath;
+    struct ccfs_stamp stamp; // as of the last time it was archived
+};
+
+// an executable or library as of its last successful link
+struct depdb_link {
+    char *outpath;
+    uint64_t fingerprint;      // its objs, their stamps and the link command
+    struct ccfs_stamp output;  // stamp of the output right after the link
+    struct depdb_member *members; // static libraries only, sorted by path
+    size_t nmembers;
+    bool seen;                 // still linked by this build
+};
+
+struct depdb {
+    pthread_mutex_t lock;
+    pthread_cond_t scanned;
+    unsigned generation;
+    size_t include_cycles;
+    struct cc_arena *arena;
+    struct cc_trie files;
+    struct cc_trie tus;
+    struct cc_trie links;
+    ccstr path;
+
+    // loaded records by id, and one bit per translation
+    // unit that is set when any of its inputs changed
+    struct depdb_file **files_by_id;
+    size_t nfiles;
+    struct depdb_tu **tus_by_id;
+    size_t ntus;
+    uint64_t *dirty;
+    size_t nchanged;
+    size_t ndirty;
+
+    // wall time of the target's longest link, as of the previous
+    // build and as observed during this build (0 until a link ran)
+    uint64_t recorded_link_ns;
+    uint64_t current_link_ns;
+};
+
+// loads the database from path, a missing or incompatible
+// file simply results in an empty database
+int depdb_load(struct depdb *db, const char *path);
+
+// writes all translation units and outputs seen during this build
+int depdb_save(struct depdb *db);
+void depdb_free(struct depdb *db);
+
+// find or insert the file entry for path
+struct depdb_file* depdb_file(struct depdb *db, const char *path);
+
+// stats the file once per build (hashing it if the stamp differs),
+// returns true if its contents differ from what was recorded by
+// the previous build
+bool depdb_file_changed(struct depdb *db, struct depdb_file *file);
+
+// stats every recorded file once and propagates the changed ones to
+// their translation units through the reverse index, must be called
+// after loading and before any translation unit is queried
+void depdb_mark_dirty(struct depdb *db);
+
+// true if any input of a recorded translation unit changed since the
+// previous build, units that were not recorded are always dirty
+bool depdb_tu_dirty(const struct depdb *db, const struct depdb_tu *tu);
+
+struct depdb_tu* depdb_find_tu(struct depdb *db, const char *srcpath);
+
+// replaces the record of a translation unit after it was scanned,
+// the new record is not considered built until depdb_set_built
+struct depdb_tu* depdb_update_tu(struct depdb *db, const char *srcpath, const char *objpath,
+                                 bool main_file, struct depdb_file **headers, size_t nheaders, bool depfile);
+
+// marks a recorded translation unit as still part of the build
+void depdb_keep_tu(struct depdb *db, struct depdb_tu *tu);
+
+void depdb_set_main_file(struct depdb *db, struct depdb_tu *tu, bool main_file);
+
+// records whether the obj is up to date with the recorded inputs and the
+// command it was compiled with, a failed compile is retried by the next
+// build even if nothing changed
+void depdb_set_built(struct depdb *db, struct depdb_tu *tu, bool built, uint64_t cmdhash);
+
+// durations are recorded so the next build can start the
+// longest compiles first, links of a target keep the longest
+void depdb_set_duration(struct depdb *db, struct depdb_tu *tu, uint64_t duration_ns);
+void depdb_set_link_duration(struct depdb *db, uint64_t duration_ns);
+
+// the record of the output as of the previous build, or NULL
+struct depdb_link* depdb_find_link(struct depdb *db, const char *outpath);
+
+// marks a recorded output that was up to date as still part of the build
+void depdb_keep_link(struct depdb *db, struct depdb_link *link);
+
+// true if the previous build recorded outputs and all of them are still
+// what it linked, so the links may be skipped
+bool depdb_outputs_unchanged(struct depdb *db);
+
+// replaces the record of an output after it was linked, outputs that
+// failed to link are left unrecorded so the next build retries them
+void depdb_set_link(struct depdb *db, const char *outpath, uint64_t fingerprint, const struct ccfs_stamp *output,
+                    char **members, const struct ccfs_stamp *stamps, size_t nmembers);
+
+// returns true if the caller won the right to scan the file and must
+// then call depdb_set_includes, returns false once the file was scanned
+// (waiting for another thread to finish scanning it if needed)
+bool depdb_claim_scan(struct depdb *db, struct depdb_file *file);
+void depdb_set_includes(struct depdb *db, struct depdb_file *file, struct depdb_file **includes, size_t count);
+
+// collects the transitive set of headers reachable from roots, along with
+// their newest mtime, from the per build memo. Returns the number of
+// headers that still need to be scanned (see closure->pending), in which
+// case the query must be repeated after scanning them.
+size_t depdb_header_closure(struct depdb *db, struct depdb_file **roots, size_t nroots, struct depdb_closure *closure);
+void depdb_closure_free(struct depdb_closure *closure);
+
+#endif // _DEPDB_H_
@@ -0,0 +1,536 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2025 Josh Simonot
+ */
+
+#include "executor.h"
+#include "process.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct executor_job {
+    struct executor_job *next;
+    struct command cmd;
+    void *ctx;
+    executor_done_func done;
+    bool link;
+    int token;
+    uint64_t start_ns;
+#ifdef __linux__
+    pid_t pid;
+    int pidfd;
+    int outfd; // read end of the command's output pipe, -1 once closed
+    struct job_event *exit_event;
+    struct job_event *output_event;
+    char *output;
+    size_t outlen;
+    size_t outcap;
+#endif
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// prints everything about a finished command with a single write, so
+// nothing printed concurrently ends up in the middle of it
+static void report_job(struct executor *ex, const struct command *cmd, bool echoed, const char *output, size_t outlen, int status) {
+    const char *line = cmd->line;
+    pthread_mutex_lock(&ex->lock);
+    size_t finished = ++ex->nfinished;
+    size_t total = ex->nsubmitted;
+    pthread_mutex_unlock(&ex->lock);
+
+    // commands terminated after the first error are not failures of their own
+    bool failed = status != 0 && !process_terminating();
+    bool show_output = !ex->quiet || failed;
+
+    size_t size = strlen(line) + (cmd->label ? strlen(cmd->label) : 0) + outlen + 128;
+    char *report = malloc(size);
+    if (report == NULL) {
+        printf("%s: out of memory\n", __func__);
+        abort();
+    }
+    size_t len = 0;
+    if (!ex->quiet) {
+        if (!echoed) {
+            len += snprintf(report + len, size - len, "%s\n", line);
+        }
+    } else if (failed) {
+        len += snprintf(report + len, size - len, "%sFAILED: %s\n", ex->progress ? "\r\033[K" : "", line);
+    } else if (ex->progress) {
+        const char *label = cmd->label ? cmd->label : line;
+        len += snprintf(report + len, size - len, "\r[%zu/%zu] %.60s\033[K", finished, total, label);
+    }
+    if (show_output && outlen > 0) {
+        memcpy(report + len, output, outlen);
+        len += outlen;
+    }
+    if (len > 0) {
+        fwrite(report, 1, len, stdout);
+        if (ex->progress) {
+            fflush(stdout);
+        }
+    }
+    free(report);
+}
+
+// links running on build threads wait for a link slot, the event
+// loop only starts a link once there is one
+static void acquire_link_slot(struct executor *ex) {
+    pthread_mutex_lock(&ex->lock);
+    while (ex->link_jobs > 0 && ex->nlinks >= ex->link_jobs) {
+        pthread_cond_wait(&ex->link_done, &ex->lock);
+    }
+    ex->nlinks++;
+    pthread_mutex_unlock(&ex->lock);
+}
+
+static void release_link_slot(struct executor *ex) {
+    pthread_mutex_lock(&ex->lock);
+    ex->nlinks--;
+    pthread_cond_signal(&ex->link_done);
+    pthread_mutex_unlock(&ex->lock);
+}
+
+// runs the command on the calling thread, its output is not captured
+static void run_sync(struct executor *ex, struct command *cmd, void *ctx, executor_done_func done, bool link) {
+    pthread_mutex_lock(&ex->lock);
+    ex->nsubmitted++;
+    pthread_mutex_unlock(&ex->lock);
+
+    if (link) {
+        acquire_link_slot(ex);
+    }
+    int token = jobserver_acquire(ex->jobserver);
+    if (!ex->quiet) {
+        printf("%s\n", cmd->line);
+    }
+    uint64_t start = now_ns();
+    int status = process_run(cmd);
+    uint64_t duration = now_ns() - start;
+    jobserver_release(ex->jobserver, token);
+    if (link) {
+        release_link_slot(ex);
+    }
+    report_job(ex, cmd, true, NULL, 0, status);
+    command_free(cmd);
+    done(ctx, status, duration);
+}
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// what an epoll event of a job is about, both events of one job can
+// arrive in the same batch
+struct job_event {
+    struct executor_job *job;
+    bool output;
+};
+
+static struct executor_job* job_new(struct command *cmd, void *ctx, executor_done_func done) {
+    struct executor_job *job = calloc(1, sizeof *job + 2 * sizeof(struct job_event));
+    if (job == NULL) {
+        printf("%s: out of memory\n", __func__);
+        abort();
+    }
+    job->cmd = *cmd;
+    *cmd = (struct command) {0};
+    job->ctx = ctx;
+    job->done = done;
+    job->pidfd = -1;
+    job->outfd = -1;
+    job->exit_event = (struct job_event *)(job + 1);
+    job->output_event = job->exit_event + 1;
+    *job->exit_event = (struct job_event) { job, false };
+    *job->output_event = (struct job_event) { job, true };
+    return job;
+}
+
+// distinguishes the wakeup and jobserver fds from jobs in epoll events
+static char wake_tag, tokens_tag;
+
+static int pidfd_open(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static void watch_tokens(struct executor *ex, bool watch) {
+    if (watch == ex->watching_tokens) {
+        return;
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &tokens_tag };
+    epoll_ctl(ex->epollfd, watch ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, ex->jobserver->readfd, &ev);
+    ex->watching_tokens = watch;
+}
+
+static void finish_job(struct executor *ex, struct executor_job *job, int status) {
+    uint64_t duration = now_ns() - job->start_ns;
+    jobserver_release(ex->jobserver, job->token);
+    if (job->link) {
+        pthread_mutex_lock(&ex->lock);
+        ex->nlinks--;
+        pthread_mutex_unlock(&ex->lock);
+    }
+    report_job(ex, &job->cmd, false, job->output, job->outlen, status);
+    job->done(job->ctx, status, duration);
+    command_free(&job->cmd);
+    free(job->output);
+    free(job);
+}
+
+// reads what the command wrote so far, the pipe only holds 64K, and a
+// command blocks writing to a full one
+static void drain_output(struct executor *ex, struct executor_job *job) {
+    while (job->outfd != -1) {
+        if (job->outcap - job->outlen < 4096) {
+            job->outcap = job->outcap ? 2 * job->outcap : 8192;
+            job->output = realloc(job->output, job->outcap);
+            if (job->output == NULL) {
+                printf("%s: out of memory\n", __func__);
+                abort();
+            }
+        }
+        ssize_t n = read(job->outfd, job->output + job->outlen, job->outcap - job->outlen);
+        if (n > 0) {
+            job->outlen += n;
+            continue;
+        }
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1 && errno == EAGAIN) {
+            return;
+        }
+        // end of the output, or nothing more can be read
+        epoll_ctl(ex->epollfd, EPOLL_CTL_DEL, job->outfd, NULL);
+        close(job->outfd);
+        job->outfd = -1;
+    }
+}
+
+// the output pipe is inherited by any command started after it was
+// created, and closes on exec, only the event loop starts commands
+static int output_pipe(int fds[2]) {
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    return 0;
+}
+
+static void start_job(struct executor *ex, struct executor_job *job) {
+    // without a pipe the output goes straight to the terminal
+    int fds[2] = { -1, -1 };
+    output_pipe(fds);
+
+    job->start_ns = now_ns();
+    job->pid = process_spawn(&job->cmd, fds[1]);
+    if (fds[1] != -1) {
+        close(fds[1]);
+    }
+    if (job->pid == -1) {
+        if (fds[0] != -1) {
+            close(fds[0]);
+        }
+        finish_job(ex, job, -1);
+        return;
+    }
+    if (fds[0] != -1) {
+        job->outfd = fds[0];
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = job->output_event };
+        epoll_ctl(ex->epollfd, EPOLL_CTL_ADD, job->outfd, &ev);
+    }
+    if (ex->pidfds) {
+        job->pidfd = pidfd_open(job->pid);
+        if (job->pidfd == -1) {
+            // old kernel, fall back to polling for every job
+            ex->pidfds = false;
+        } else {
+            struct epoll_event ev = { .events = EPOLLIN, .data.ptr = job->exit_event };
+            epoll_ctl(ex->epollfd, EPOLL_CTL_ADD, job->pidfd, &ev);
+            process_set_pidfd(job->pid, job->pidfd);
+        }
+    }
+    job->next = ex->running;
+    ex->running = job;
+    ex->nrunning++;
+}
+
+static void push_job(struct executor_queue *queue, struct executor_job *job) {
+    if (queue->tail != NULL) {
+        queue->tail->next = job;
+    } else {
+        queue->head = job;
+    }
+    queue->tail = job;
+}
+
+static void pop_job(struct executor_queue *queue) {
+    queue->head = queue->head->next;
+    if (queue->head == NULL) {
+        queue->tail = NULL;
+    }
+}
+
+// the queue of the next job to start, links first unless too many
+// are running already, NULL if no job can start
+static struct executor_queue* next_queue(struct executor *ex) {
+    if (ex->links.head != NULL && (ex->link_jobs == 0 || ex->nlinks < ex->link_jobs)) {
+        return &ex->links;
+    }
+    return ex->compiles.head != NULL ? &ex->compiles : NULL;
+}
+
+// starts queued jobs for as long as job slots are free
+static void start_queued(struct executor *ex) {
+    for (;;) {
+        pthread_mutex_lock(&ex->lock);
+        bool ready = next_queue(ex) != NULL;
+        pthread_mutex_unlock(&ex->lock);
+        if (!ready) {
+            watch_tokens(ex, false);
+            return;
+        }
+        int token;
+        if (!jobserver_try_acquire(ex->jobserver, &token)) {
+            watch_tokens(ex, ex->jobserver->enabled);
+            return;
+        }
+        // only the event loop takes jobs off the queues
+        pthread_mutex_lock(&ex->lock);
+        struct executor_queue *queue = next_queue(ex);
+        struct executor_job *job = queue->head;
+        pop_job(queue);
+        if (job->link) {
+            ex->nlinks++;
+        }
+        pthread_mutex_unlock(&ex->lock);
+
+        job->token = token;
+        start_job(ex, job);
+    }
+}
+
+static void unlink_job(struct executor *ex, struct executor_job *job) {
+    for (struct executor_job **itr = &ex->running; *itr != NULL; itr = &(*itr)->next) {
+        if (*itr == job) {
+            *itr = job->next;
+            ex->nrunning--;
+            return;
+        }
+    }
+}
+
+// the command exited, anything it wrote is in the pipe by now, what
+// its own children write later is dropped
+static void close_job(struct executor *ex, struct executor_job *job) {
+    unlink_job(ex, job);
+    drain_output(ex, job);
+    if (job->outfd != -1) {
+        epoll_ctl(ex->epollfd, EPOLL_CTL_DEL, job->outfd, NULL);
+        close(job->outfd);
+        job->outfd = -1;
+    }
+    if (job->pidfd != -1) {
+        epoll_ctl(ex->epollfd, EPOLL_CTL_DEL, job->pidfd, NULL);
+        close(job->pidfd);
+        job->pidfd = -1;
+    }
+}
+
+static void reap_job(struct executor *ex, struct executor_job *job) {
+    int status = process_wait(job->pid);
+    close_job(ex, job);
+    finish_job(ex, job, status);
+}
+
+// without pidfds every running job is checked on each turn of the loop
+static void poll_jobs(struct executor *ex) {
+    struct executor_job *job = ex->running;
+    while (job != NULL) {
+        struct executor_job *next = job->next;
+        int status;
+        if (job->pidfd == -1 && process_poll(job->pid, &status)) {
+            close_job(ex, job);
+            finish_job(ex, job, status);
+        }
+        job = next;
+    }
+}
+
+static void* event_loop(void *arg) {
+    struct executor *ex = arg;
+    struct epoll_event events[64];
+
+    for (;;) {
+        start_queued(ex);
+
+        pthread_mutex_lock(&ex->lock);
+        bool done = ex->stopping && ex->compiles.head == NULL && ex->links.head == NULL && ex->nrunning == 0;
+        pthread_mutex_unlock(&ex->lock);
+        if (done) {
+            break;
+        }
+
+        // only jobs without a pidfd need the loop to wake up by itself
+        bool polling = false;
+        for (struct executor_job *job = ex->running; job != NULL && !polling; job = job->next) {
+            polling = (job->pidfd == -1);
+        }
+        int n = epoll_wait(ex->epollfd, events, 64, polling ? 10 : -1);
+
+        // output first, reaping a job frees it along with its events
+        for (int i = 0; i < n; ++i) {
+            void *tag = events[i].data.ptr;
+            if (tag == &wake_tag) {
+                uint64_t count;
+                (void)!read(ex->wakefd, &count, sizeof count);
+            } else if (tag != &tokens_tag && ((struct job_event *)tag)->output) {
+                drain_output(ex, ((struct job_event *)tag)->job);
+            }
+        }
+        for (int i = 0; i < n; ++i) {
+            void *tag = events[i].data.ptr;
+            if (tag != &wake_tag && tag != &tokens_tag && !((struct job_event *)tag)->output) {
+                reap_job(ex, ((struct job_event *)tag)->job);
+            }
+        }
+        if (polling) {
+            poll_jobs(ex);
+        }
+    }
+    return NULL;
+}
+
+static void wake(struct executor *ex) {
+    uint64_t one = 1;
+    (void)!write(ex->wakefd, &one, sizeof one);
+}
+
+int executor_init(struct executor *ex, struct jobserver *jobserver, bool quiet, size_t link_jobs) {
+    memset(ex, 0, sizeof *ex);
+    ex->jobserver = jobserver;
+    ex->quiet = quiet;
+    ex->progress = quiet && isatty(STDOUT_FILENO);
+    ex->link_jobs = link_jobs;
+    pthread_mutex_init(&ex->lock, NULL);
+    pthread_cond_init(&ex->link_done, NULL);
+
+    ex->epollfd = epoll_create1(EPOLL_CLOEXEC);
+    ex->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ex->epollfd == -1 || ex->wakefd == -1) {
+        printf("INFO: no event loop for commands (%s), running them on build threads\n", strerror(errno));
+        return 0;
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &wake_tag };
+    epoll_ctl(ex->epollfd, EPOLL_CTL_ADD, ex->wakefd, &ev);
+
+    ex->pidfds = true;
+    int err = pthread_create(&ex->thread, NULL, event_loop, ex);
+    if (err != 0) {
+        printf("INFO: no event loop for commands (%s), running them on build threads\n", strerror(err));
+        return 0;
+    }
+    ex->async = true;
+    return 0;
+}
+
+static void submit(struct executor *ex, struct command *cmd, void *ctx, executor_done_func done, bool link) {
+    if (!ex->async) {
+        run_sync(ex, cmd, ctx, done, link);
+        return;
+    }
+    struct executor_job *job = job_new(cmd, ctx, done);
+    job->link = link;
+    pthread_mutex_lock(&ex->lock);
+    ex->nsubmitted++;
+    push_job(link ? &ex->links : &ex->compiles, job);
+    pthread_mutex_unlock(&ex->lock);
+    wake(ex);
+}
+
+int executor_threads(struct executor *ex, int jobs) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (!ex->async || ncpu < 1 || ncpu >= jobs) {
+        return jobs;
+    }
+    return ncpu;
+}
+
+void executor_free(struct executor *ex) {
+    if (ex->async) {
+        pthread_mutex_lock(&ex->lock);
+        ex->stopping = true;
+        pthread_mutex_unlock(&ex->lock);
+        wake(ex);
+        pthread_join(ex->thread, NULL);
+    }
+    if (ex->epollfd != -1) {
+        close(ex->epollfd);
+    }
+    if (ex->wakefd != -1) {
+        close(ex->wakefd);
+    }
+    pthread_cond_destroy(&ex->link_done);
+    pthread_mutex_destroy(&ex->lock);
+    memset(ex, 0, sizeof *ex);
+}
+
+#else
+
+int executor_init(struct executor *ex, struct jobserver *jobserver, bool quiet, size_t link_jobs) {
+    memset(ex, 0, sizeof *ex);
+    ex->jobserver = jobserver;
+    ex->quiet = quiet;
+    ex->link_jobs = link_jobs;
+    pthread_mutex_init(&ex->lock, NULL);
+    pthread_cond_init(&ex->link_done, NULL);
+    return 0;
+}
+
+static void submit(struct executor *ex, struct command *cmd, void *ctx, executor_done_func done, bool link) {
+    run_sync(ex, cmd, ctx, done, link);
+}
+
+int executor_threads(struct executor *ex, int jobs) {
+    (void)ex;
+    return jobs;
+}
+
+void executor_free(struct executor *ex) {
+    pthread_cond_destroy(&ex->link_done);
+    pthread_mutex_destroy(&ex->lock);
+    memset(ex, 0, sizeof *ex);
+}
+
+#endif
+
+void executor_run(struct executor *ex, struct command *cmd, void *ctx, executor_done_func done) {
+    submit(ex, cmd, ctx, done, false);
+}
+
+void executor_run_link(struct executor *ex, struct command *cmd, void *ctx, executor_done_func done) {
+    submit(ex, cmd, ctx, done, true);
+}
@@ -0,0 +1,100 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2025 Josh Simonot
+ */
+
+#ifndef _EXECUTOR_H_
+#define _EXECUTOR_H_
+
+#include "command.h"
+#include "jobserver.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Runs build commands without tying up a thread per running command.
+//
+// Commands are queued, then started and reaped by a single event loop
+// thread (epoll over one pidfd per child on Linux), which starts queued
+// commands whenever the jobserver hands out a job slot. Each completion
+// is passed to a callback on the event loop thread, which should only
+// hand it back to the scheduler. The number of running commands is only
+// limited by the job slots, not by the number of threads.
+//
+// The stdout and stderr of each command go to a pipe drained by the
+// event loop, and are printed along with the command line in one go
+// once it exited, so the output of concurrent commands never mixes.
+// In quiet mode only failed commands are printed, and a progress line
+// when stdout is a terminal.
+//
+// Links are queued apart from compiles, they go first whenever a job
+// slot is free, as long as fewer than link_jobs links are running.
+// Linkers are hungry for memory, the bound keeps a few hundred of them
+// from running at once.
+//
+// Without an event loop (other systems) commands run synchronously on
+// the calling thread, which then also waits for the job slot, and
+// their output goes straight to the terminal.
+
+// status is the exit code (see process_run), duration_ns the wall
+// time from starting the command until it was reaped
+typedef void (*executor_done_func)(void *ctx, int status, uint64_t duration_ns);
+
+struct executor_job;
+
+struct executor_queue {
+    struct executor_job *head;
+    struct executor_job *tail;
+};
+
+struct executor {
+    struct jobserver *jobserver;
+    bool async;
+    bool quiet;
+    bool progress;    // quiet, and stdout is a terminal
+    size_t link_jobs; // links running at once, 0 for no bound
+
+    // shared with the event loop
+    pthread_mutex_t lock;
+    pthread_cond_t link_done;
+    struct executor_queue compiles; // waiting for a job slot
+    struct executor_queue links;
+    size_t nlinks;
+    bool stopping;
+    size_t nsubmitted;
+    size_t nfinished;
+
+    // event loop only
+    pthread_t thread;
+    int epollfd;
+    int wakefd;
+    bool pidfds;          // children are reaped through pidfds
+    bool watching_tokens; // jobserver fd is in the epoll set
+    struct executor_job *running;
+    size_t nrunning;
+};
+
+// starts the event loop, commands take their job slots from the jobserver
+int executor_init(struct executor *ex, struct jobserver *jobserver, bool quiet, size_t link_jobs);
+
+// queues the command, done is called once it exited (or failed to
+// start) right after it was printed, the executor takes over the
+// command and frees it
+void executor_run(struct executor *ex, struct command *cmd, void *ctx, executor_done_func done);
+
+// queues a link command, like executor_run
+void executor_run_link(struct executor *ex, struct command *cmd, void *ctx, executor_done_func done);
+
+// build threads needed to keep the given number of commands running, with
+// the event loop threads only prepare commands so one per core is enough
+int executor_threads(struct executor *ex, int jobs);
+
+// waits for every queued and running command, then stops the event loop
+void executor_free(struct executor *ex);
+
+#endif // _EXECUTOR_H_
@@ -0,0 +1,244 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2025 Josh Simonot
+ */
+
+#include "include_resolver.h"
+
+#include "libcc/cc_hash.h"
+#include "vendor/cwalk/cwalk.h"
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// sorted names of the files in a directory,
+// empty if the directory does not exist
+struct dir_listing {
+    char **names;
+    size_t count;
+};
+
+static char* arena_strndup(struct cc_arena *arena, const char *str, size_t len) {
+    char *dup = cc_alloc(arena, len + 1);
+    if (dup != NULL) {
+        memcpy(dup, str, len);
+        dup[len] = 0;
+    }
+    return dup;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// reads the directory on first use, caller must hold the lock
+static struct dir_listing* get_listing(struct include_resolver *resolver, const char *dirpath) {
+    const char *key = (dirpath[0] != 0) ? dirpath : ".";
+
+    struct dir_listing *listing = cc_trie_search(&resolver->listings, CC_TRIE_STR_KEY(key));
+    if (listing != NULL) {
+        return listing;
+    }
+    listing = cc_alloc(resolver->arena, sizeof *listing);
+
+    DIR *dir = opendir(key);
+    if (dir != NULL) {
+        size_t cap = 0;
+        struct dirent *entry;
+
+        while ((entry = readdir(dir)) != NULL) {
+            #ifdef _DIRENT_HAVE_D_TYPE
+            if (entry->d_type == DT_DIR) {
+                continue;
+            }
+            #endif
+            if (listing->count == cap) {
+                cap = cap ? 2*cap : 64;
+                listing->names = realloc(listing->names, cap * sizeof *listing->names);
+                if (listing->names == NULL) {
+                    printf("%s: out of memory\n", __func__);
+                    abort();
+                }
+            }
+            listing->names[listing->count++] = arena_strndup(resolver->arena, entry->d_name, strlen(entry->d_name));
+        }
+        closedir(dir);
+
+        // move the names into the arena so they are freed with it
+        char **names = cc_alloc(resolver->arena, (listing->count + 1) * sizeof *names);
+        if (listing->count > 0) {
+            memcpy(names, listing->names, listing->count * sizeof *names);
+        }
+        free(listing->names);
+        listing->names = names;
+        qsort(listing->names, listing->count, sizeof *listing->names, compare_names);
+    }
+    cc_trie_insert(&resolver->listings, CC_TRIE_STR_KEY(key), listing);
+    return listing;
+}
+
+// checks if spelling exists relative to dir using the cached listings
+static bool probe(struct include_resolver *resolver, const char *dir, const char *spelling, char *out, size_t outsize) {
+    char joined[PATH_MAX];
+    size_t reqsize;
+
+    if (dir != NULL && dir[0] != 0) {
+        reqsize = cwk_path_join(dir, spelling, joined, sizeof joined);
+    } else {
+        reqsize = snprintf(joined, sizeof joined, "%s", spelling);
+    }
+    if (reqsize >= sizeof joined) {
+        return false;
+    }
+    if (cwk_path_normalize(joined, out, outsize) >= outsize) {
+        return false;
+    }
+
+    size_t dirname_len;
+    cwk_path_get_dirname(out, &dirname_len);
+
+    char dirpath[PATH_MAX];
+    snprintf(dirpath, sizeof dirpath, "%.*s", (int)dirname_len, out);
+    const char *basename = out + dirname_len;
+
+    pthread_mutex_lock(&resolver->lock);
+    struct dir_listing *listing = get_listing(resolver, dirpath);
+    bool found = listing->count > 0
+              && bsearch(&basename, listing->names, listing->count, sizeof *listing->names, compare_names) != NULL;
+    pthread_mutex_unlock(&resolver->lock);
+
+    return found;
+}
+
+void include_resolver_init(struct include_resolver *resolver, ccstrview incpaths) {
+    memset(resolver, 0, sizeof *resolver);
+    pthread_mutex_init(&resolver->lock, NULL);
+    pthread_rwlock_init(&resolver->cache_lock, NULL);
+    resolver->arena = cc_new_arena_calloc_wrapper();
+    resolver->listings.arena = resolver->arena;
+    resolver->lookups.arena = resolver->arena;
+
+    size_t count = 1 + ccsv_charcount(incpaths, ' ');
+    resolver->incdirs = cc_alloc(resolver->arena, count * sizeof *resolver->incdirs);
+
+    while (incpaths.len > 0) {
+        ccstrview path = ccsv_tokenize(&incpaths, ' ');
+        if (ccstrncmp(path, ccsv_raw("-I"), 2) == 0) {
+            path = ccsv_offset(path, 2);
+        }
+        if (path.len == 0) {
+            continue;
+        }
+        char raw[PATH_MAX];
+        char normalized[PATH_MAX];
+        snprintf(raw, sizeof raw, "%.*s", (int)path.len, path.cstr);
+        size_t len = cwk_path_normalize(raw, normalized, sizeof normalized);
+        if (len >= sizeof normalized) {
+            continue;
+        }
+        resolver->incdirs[resolver->nincdirs++] = arena_strndup(resolver->arena, normalized, len);
+    }
+}
+
+void include_resolver_free(struct include_resolver *resolver) {
+    if (resolver->arena != NULL) {
+        cc_destroy_arena_calloc_wrapper(resolver->arena);
+    }
+    pthread_mutex_destroy(&resolver->lock);
+    pthread_rwlock_destroy(&resolver->cache_lock);
+    memset(resolver, 0, sizeof *resolver);
+}
+
+static bool search(struct include_resolver *resolver, const char *dirpath, const char *spelling,
+                   char *out, size_t outsize) {
+    if (cwk_path_is_absolute(spelling)) {
+        return probe(resolver, NULL, spelling, out, outsize);
+    }
+    // "quoted" includes are first looked up next to the including file
+    if (dirpath != NULL && probe(resolver, dirpath, spelling, out, outsize)) {
+        return true;
+    }
+    for (size_t i = 0; i < resolver->nincdirs; ++i) {
+        if (probe(resolver, resolver->incdirs[i], spelling, out, outsize)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// cached outcome of one lookup, path is NULL if nothing was found
+struct include_lookup {
+    char *key;
+    char *path;
+};
+
+bool include_resolve(struct include_resolver *resolver, const char *includer, const char *spelling,
+                     bool quoted, char *out, size_t outsize) {
+    char dirpath[PATH_MAX];
+    bool next_to_includer = quoted && includer != NULL && !cwk_path_is_absolute(spelling);
+    if (next_to_includer) {
+        size_t dirname_len;
+        cwk_path_get_dirname(includer, &dirname_len);
+        snprintf(dirpath, sizeof dirpath, "%.*s", (int)dirname_len, includer);
+    }
+
+    // the search context is part of the key: "dir\nspelling" or "<spelling",
+    // which is hashed to keep the trie shallow
+    char key[2*PATH_MAX + 2];
+    int keylen;
+    if (next_to_includer) {
+        keylen = snprintf(key, sizeof key, "%s\n%s", dirpath, spelling);
+    } else {
+        keylen = snprintf(key, sizeof key, "<%s", spelling);
+    }
+    if (keylen < 0 || (size_t)keylen >= sizeof key) {
+        return search(resolver, next_to_includer ? dirpath : NULL, spelling, out, outsize);
+    }
+    uint64_t hash = cc_hash64(key, keylen, 0);
+
+    pthread_rwlock_rdlock(&resolver->cache_lock);
+    struct include_lookup *cached = cc_trie_search(&resolver->lookups, (const uint8_t*)&hash, sizeof hash);
+    pthread_rwlock_unlock(&resolver->cache_lock);
+
+    if (cached != NULL && strcmp(cached->key, key) == 0) {
+        if (cached->path == NULL) {
+            atomic_fetch_add_explicit(&resolver->hits, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&resolver->missing_hits, 1, memory_order_relaxed);
+            return false;
+        }
+        if (strlen(cached->path) < outsize) {
+            atomic_fetch_add_explicit(&resolver->hits, 1, memory_order_relaxed);
+            strcpy(out, cached->path);
+            return true;
+        }
+    }
+    atomic_fetch_add_explicit(&resolver->misses, 1, memory_order_relaxed);
+
+    bool found = search(resolver, next_to_includer ? dirpath : NULL, spelling, out, outsize);
+
+    // racing threads resolve the same key to the same result,
+    // whichever inserts last wins
+    struct include_lookup *lookup = cc_alloc(resolver->arena, sizeof *lookup);
+    lookup->key = arena_strndup(resolver->arena, key, keylen);
+    lookup->path = found ? arena_strndup(resolver->arena, out, strlen(out)) : NULL;
+
+    pthread_rwlock_wrlock(&resolver->cache_lock);
+    cc_trie_insert(&resolver->lookups, (const uint8_t*)&hash, sizeof hash, lookup);
+    pthread_rwlock_unlock(&resolver->cache_lock);
+
+    return found;
+}
+
+struct include_resolver_stats include_resolver_stats(struct include_resolver *resolver) {
+    return (struct include_resolver_stats){
+        .hits = atomic_load(&resolver->hits),
+        .missing_hits = atomic_load(&resolver->missing_hits),
+        .misses = atomic_load(&resolver->misses),
+    };
+}
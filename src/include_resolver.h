@@ -0,0 +1,64 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2025 Josh Simonot
+ */
+
+#ifndef _INCLUDE_RESOLVER_H_
+#define _INCLUDE_RESOLVER_H_
+
+#include "libcc/cc_allocator.h"
+#include "libcc/cc_strings.h"
+#include "libcc/cc_trie_map.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Finds the file an include directive refers to the same way the
+// compiler does: "quoted" includes look next to the including file
+// first, then both forms search the target's INCPATHS in order.
+//
+// Each directory is read once per build and its listing cached, so
+// probing a candidate location never costs a failed stat.
+//
+// The outcome of each lookup is also cached per search context (the
+// includer's directory for "quoted" includes, the INCPATHS alone for
+// <bracketed> ones), so a system header that is not part of the project
+// is looked for once per build no matter how many files include it.
+struct include_resolver {
+    pthread_mutex_t lock;
+    struct cc_arena *arena;
+    struct cc_trie listings;
+    char **incdirs;
+    size_t nincdirs;
+
+    pthread_rwlock_t cache_lock;
+    struct cc_trie lookups;
+    atomic_size_t hits;
+    atomic_size_t missing_hits; // hits for headers outside the project
+    atomic_size_t misses;
+};
+
+struct include_resolver_stats {
+    size_t hits;
+    size_t missing_hits;
+    size_t misses;
+};
+
+// incpaths is the space separated list of include directories,
+// with or without their -I prefix
+void include_resolver_init(struct include_resolver *resolver, ccstrview incpaths);
+void include_resolver_free(struct include_resolver *resolver);
+
+// writes the normalized path of the included file into out, returns
+// false if the file can't be found in any of the searched directories
+bool include_resolve(struct include_resolver *resolver, const char *includer, const char *spelling,
+                     bool quoted, char *out, size_t outsize);
+
+struct include_resolver_stats include_resolver_stats(struct include_resolver *resolver);
+
+#endif // _INCLUDE_RESOLVER_H_
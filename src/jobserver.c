@@ -0,0 +1,371 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2025 Josh Simonot
+ */
+
+#include "jobserver.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void jobserver_init(struct jobserver *js) {
+    memset(js, 0, sizeof *js);
+    js->readfd = js->writefd = -1;
+    js->pipefds[0] = js->pipefds[1] = -1;
+    pthread_mutex_init(&js->lock, NULL);
+    pthread_cond_init(&js->freed, NULL);
+}
+
+static bool take_implicit(struct jobserver *js) {
+    return !atomic_exchange(&js->implicit_taken, true);
+}
+
+// caller must hold the lock
+static void count_locally(struct jobserver *js, int jobs) {
+    js->local = true;
+    js->local_free = jobs - 1 - js->held;
+    js->held = 0;
+}
+
+void jobserver_local(struct jobserver *js, int jobs) {
+    jobserver_init(js);
+    js->jobs = jobs;
+    count_locally(js, jobs);
+}
+
+// a slot counted within this build
+static bool take_local(struct jobserver *js) {
+    pthread_mutex_lock(&js->lock);
+    bool taken = js->local_free > 0;
+    if (taken) {
+        js->local_free--;
+    }
+    pthread_mutex_unlock(&js->lock);
+    return taken;
+}
+
+static void release_local(struct jobserver *js) {
+    pthread_mutex_lock(&js->lock);
+    js->local_free++;
+    pthread_cond_signal(&js->freed);
+    pthread_mutex_unlock(&js->lock);
+}
+
+static void wait_local(struct jobserver *js) {
+    pthread_mutex_lock(&js->lock);
+    while (js->local_free <= 0 && atomic_load(&js->implicit_taken)) {
+        pthread_cond_wait(&js->freed, &js->lock);
+    }
+    pthread_mutex_unlock(&js->lock);
+}
+
+#ifdef _WIN32
+
+// make uses a named semaphore on windows, which is not supported,
+// the build is only limited by its own -j level
+
+int jobserver_connect(struct jobserver *js) {
+    memset(js, 0, sizeof *js);
+    return -1;
+}
+
+int jobserver_serve(struct jobserver *js, int jobs) {
+    (void)jobs;
+    memset(js, 0, sizeof *js);
+    return -1;
+}
+
+bool jobserver_try_acquire(struct jobserver *js, int *token) {
+    if (!js->local || take_implicit(js)) {
+        *token = JOBSERVER_IMPLICIT;
+        return true;
+    }
+    if (take_local(js)) {
+        *token = JOBSERVER_LOCAL;
+        return true;
+    }
+    return false;
+}
+
+int jobserver_acquire(struct jobserver *js) {
+    int token;
+    while (!jobserver_try_acquire(js, &token)) {
+        wait_local(js);
+    }
+    return token;
+}
+
+void jobserver_release(struct jobserver *js, int token) {
+    if (token == JOBSERVER_IMPLICIT) {
+        atomic_store(&js->implicit_taken, false);
+        pthread_mutex_lock(&js->lock);
+        pthread_cond_signal(&js->freed);
+        pthread_mutex_unlock(&js->lock);
+    } else {
+        release_local(js);
+    }
+}
+
+void jobserver_free(struct jobserver *js) {
+    pthread_mutex_destroy(&js->lock);
+    pthread_cond_destroy(&js->freed);
+    memset(js, 0, sizeof *js);
+}
+
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// returns the value of the last jobserver option in MAKEFLAGS, make
+// passes the one of the closest make last, older makes call it -fds
+static bool find_auth(const char *makeflags, char *auth, size_t size) {
+    static const char *options[] = { "--jobserver-auth=", "--jobserver-fds=" };
+    const char *found = NULL;
+    for (size_t i = 0; i < sizeof options / sizeof options[0]; ++i) {
+        size_t len = strlen(options[i]);
+        for (const char *p = strstr(makeflags, options[i]); p != NULL; p = strstr(p + len, options[i])) {
+            if (found == NULL || p > found) {
+                found = p + len;
+            }
+        }
+    }
+    if (found == NULL) {
+        return false;
+    }
+    size_t len = strcspn(found, " \t");
+    if (len == 0 || len >= size) {
+        return false;
+    }
+    memcpy(auth, found, len);
+    auth[len] = 0;
+    return true;
+}
+
+// the -j level is passed along with the jobserver, as -jN
+static int find_jobs(const char *makeflags) {
+    int jobs = 0;
+    for (const char *p = makeflags; (p = strstr(p, "-j")) != NULL; p += 2) {
+        bool starts_word = (p == makeflags || p[-1] == ' ');
+        if (starts_word && p[2] >= '1' && p[2] <= '9') {
+            jobs = atoi(p + 2);
+        }
+    }
+    return jobs;
+}
+
+static bool valid_fd(int fd) {
+    return fd >= 0 && fcntl(fd, F_GETFD) != -1;
+}
+
+// a private non-blocking read end, when the system can reopen the
+// pipe, leaves the flags of the pipe shared with other processes alone
+static int nonblocking_read_end(struct jobserver *js, int readfd) {
+    char path[64];
+    snprintf(path, sizeof path, "/proc/self/fd/%d", readfd);
+    int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd != -1) {
+        js->opened = true;
+        return fd;
+    }
+    fcntl(readfd, F_SETFL, fcntl(readfd, F_GETFL) | O_NONBLOCK);
+    return readfd;
+}
+
+static int connect_auth(struct jobserver *js) {
+    const char *makeflags = getenv("MAKEFLAGS");
+    char auth[PATH_MAX];
+    if (makeflags == NULL || !find_auth(makeflags, auth, sizeof auth)) {
+        return -1;
+    }
+
+    // the read end is non-blocking, so a token taken by another process
+    // between polling and reading can't block the build, see acquire
+    if (strncmp(auth, "fifo:", 5) == 0) {
+        // opened for writing too, so reads never see the end of file
+        int fd = open(auth + 5, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (fd == -1) {
+            printf("INFO: jobserver '%s' unavailable: %s\n", auth + 5, strerror(errno));
+            return -1;
+        }
+        js->readfd = js->writefd = fd;
+        js->opened = true;
+    } else {
+        int readfd, writefd;
+        if (sscanf(auth, "%d,%d", &readfd, &writefd) != 2) {
+            printf("INFO: ignoring unknown jobserver '%s'\n", auth);
+            return -1;
+        }
+        if (!valid_fd(readfd) || !valid_fd(writefd)) {
+            printf("INFO: jobserver unavailable, add '+' to the make rule running ccbuild to share it\n");
+            return -1;
+        }
+        js->readfd = nonblocking_read_end(js, readfd);
+        js->writefd = writefd;
+    }
+    js->jobs = find_jobs(makeflags);
+    js->enabled = true;
+    return 0;
+}
+
+int jobserver_connect(struct jobserver *js) {
+    jobserver_init(js);
+    if (connect_auth(js) != 0) {
+        jobserver_free(js);
+        return -1;
+    }
+    return 0;
+}
+
+// appends the jobserver to MAKEFLAGS, replacing any previous one. Older
+// makes only know --jobserver-fds, newer ones --jobserver-auth, and each
+// ignores the option of the other
+static void export_makeflags(struct jobserver *js, int jobs) {
+    const char *makeflags = getenv("MAKEFLAGS");
+    size_t size = (makeflags ? strlen(makeflags) : 0) + 128;
+    char *flags = malloc(size);
+    if (flags == NULL) {
+        printf("%s: out of memory\n", __func__);
+        abort();
+    }
+    // make keeps the last jobserver option, appending one is enough
+    snprintf(flags, size, "%s%s-j%d --jobserver-fds=%d,%d --jobserver-auth=%d,%d", makeflags ? makeflags : "",
+             (makeflags && makeflags[0]) ? " " : "", jobs, js->pipefds[0], js->pipefds[1],
+             js->pipefds[0], js->pipefds[1]);
+    setenv("MAKEFLAGS", flags, 1);
+    free(flags);
+}
+
+// one token per job beyond the implicit one, fails rather than block
+// when the pipe can't hold that many
+static bool fill_pipe(int fd, int tokens) {
+    int flags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    bool filled = true;
+    for (int i = 0; i < tokens && filled; ++i) {
+        filled = (write(fd, "+", 1) == 1);
+    }
+    fcntl(fd, F_SETFL, flags);
+    return filled;
+}
+
+int jobserver_serve(struct jobserver *js, int jobs) {
+    jobserver_init(js);
+
+    // not close-on-exec, every command inherits the pipe
+    if (pipe(js->pipefds) != 0) {
+        printf("INFO: failed to create jobserver: %s\n", strerror(errno));
+        js->pipefds[0] = js->pipefds[1] = -1;
+        jobserver_free(js);
+        return -1;
+    }
+    js->served = true;
+    if (!fill_pipe(js->pipefds[1], jobs - 1)) {
+        printf("INFO: failed to fill jobserver: %s\n", strerror(errno));
+        jobserver_free(js);
+        return -1;
+    }
+    js->readfd = nonblocking_read_end(js, js->pipefds[0]);
+    js->writefd = js->pipefds[1];
+    js->jobs = jobs;
+    export_makeflags(js, jobs);
+    js->enabled = true;
+    return 0;
+}
+
+bool jobserver_try_acquire(struct jobserver *js, int *token) {
+    if ((!js->enabled && !js->local) || take_implicit(js)) {
+        *token = JOBSERVER_IMPLICIT;
+        return true;
+    }
+    while (js->enabled) {
+        unsigned char byte;
+        ssize_t n = read(js->readfd, &byte, 1);
+        if (n == 1) {
+            pthread_mutex_lock(&js->lock);
+            js->held++;
+            pthread_mutex_unlock(&js->lock);
+            *token = byte;
+            return true;
+        }
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return false;
+        }
+        // the jobserver went away, the build can still finish within
+        // the -j level it had, the tokens still held count against it
+        printf("INFO: lost the jobserver, limiting jobs within this build\n");
+        pthread_mutex_lock(&js->lock);
+        count_locally(js, js->jobs > 0 ? js->jobs : 1);
+        js->enabled = false;
+        pthread_mutex_unlock(&js->lock);
+    }
+    if (take_local(js)) {
+        *token = JOBSERVER_LOCAL;
+        return true;
+    }
+    return false;
+}
+
+int jobserver_acquire(struct jobserver *js) {
+    int token;
+    while (!jobserver_try_acquire(js, &token)) {
+        if (js->enabled) {
+            struct pollfd pfd = { .fd = js->readfd, .events = POLLIN };
+            poll(&pfd, 1, -1);
+        } else {
+            wait_local(js);
+        }
+    }
+    return token;
+}
+
+void jobserver_release(struct jobserver *js, int token) {
+    if (token == JOBSERVER_IMPLICIT) {
+        atomic_store(&js->implicit_taken, false);
+        pthread_mutex_lock(&js->lock);
+        pthread_cond_signal(&js->freed);
+        pthread_mutex_unlock(&js->lock);
+        return;
+    }
+    pthread_mutex_lock(&js->lock);
+    bool local = js->local;
+    if (!local) {
+        js->held--;
+    }
+    pthread_mutex_unlock(&js->lock);
+
+    // a token read from a jobserver that went away frees a local slot
+    if (local) {
+        release_local(js);
+        return;
+    }
+    unsigned char byte = token;
+    while (write(js->writefd, &byte, 1) == -1 && (errno == EINTR || errno == EAGAIN)) {
+    }
+}
+
+void jobserver_free(struct jobserver *js) {
+    if (js->opened) {
+        close(js->readfd);
+    }
+    if (js->served) {
+        close(js->pipefds[0]);
+        close(js->pipefds[1]);
+    }
+    pthread_mutex_destroy(&js->lock);
+    pthread_cond_destroy(&js->freed);
+    memset(js, 0, sizeof *js);
+    js->readfd = js->writefd = -1;
+}
+
+#endif
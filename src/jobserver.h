@@ -0,0 +1,80 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2025 Josh Simonot
+ */
+
+#ifndef _JOBSERVER_H_
+#define _JOBSERVER_H_
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// GNU make jobserver, shares one concurrency budget between make,
+// ccbuild and any build they start in turn.
+//
+// The budget is a pipe (or named fifo) holding one byte per job slot
+// beyond the first. Every process owns one implicit slot, any further
+// command has to read a token from the pipe before it starts and write
+// it back once it finished.
+//
+// When started by make (MAKEFLAGS has --jobserver-auth) ccbuild is a
+// client of make's jobserver. Otherwise it serves its own, with the -j
+// level as the budget, from a pipe inherited by the commands it starts.
+// It is exported through MAKEFLAGS as a pair of fds, which every make
+// understands (only make 4.4 and later know named fifos), so nested
+// builds started by build commands share that budget.
+//
+// Without a usable pipe the slots are only counted within this build,
+// so the -j level still holds, it just isn't shared.
+
+// token held while running on the implicit slot
+#define JOBSERVER_IMPLICIT -1
+// token held while running on a slot counted within this build
+#define JOBSERVER_LOCAL -2
+
+struct jobserver {
+    bool enabled; // slots come from the pipe
+    bool served;  // created the pipe, closes it when done
+    bool opened;  // opened readfd, the fds of make's pipe belong to make
+    int jobs;     // -j level of the make that runs the jobserver, 0 if unknown
+    int readfd;
+    int writefd;
+    int pipefds[2]; // the served pipe, as inherited by the commands
+    atomic_bool implicit_taken;
+
+    // slots counted within this build, when there is no pipe (guarded by lock)
+    pthread_mutex_t lock;
+    pthread_cond_t freed;
+    bool local;
+    int local_free;
+    int held; // tokens read from the pipe and not released yet
+};
+
+// connects to the jobserver in MAKEFLAGS, returns -1 if there is none
+// or it is not usable (make only passes it to recipes marked with '+')
+int jobserver_connect(struct jobserver *js);
+
+// creates a jobserver for the given number of jobs and exports it to
+// the commands started from now on, returns -1 if it could not
+int jobserver_serve(struct jobserver *js, int jobs);
+
+// limits this build alone to the given number of jobs, for when no
+// jobserver could be served
+void jobserver_local(struct jobserver *js, int jobs);
+
+// blocks until a job slot is free, returns the token to release
+int jobserver_acquire(struct jobserver *js);
+void jobserver_release(struct jobserver *js, int token);
+
+// takes a job slot if one is free right away, otherwise readfd
+// becomes readable once another slot may be free
+bool jobserver_try_acquire(struct jobserver *js, int *token);
+
+void jobserver_free(struct jobserver *js);
+
+#endif // _JOBSERVER_H_
@@ -17,13 +17,12 @@
 void print_usage(const char *program_name) {
     printf("Usage: %s <command>\n", program_name);
     printf("Commands:\n");
-    printf("  build [--release|debug] [--target=TARGET] [project_root|source_file]\n");
+    printf("  build [--release|debug] [--target=TARGET] [--stats] [--keep-going] [--quiet] [--link-jobs=N] [project_root|source_file]\n");
     printf("  clean\n");
 }
 
 int dispatch_build(int argc, char* argv[]) {
     struct cmdopts cmdopts = {
-        .jlevel = 1,
         .debug = true,
     };
     
@@ -31,11 +30,15 @@ int dispatch_build(int argc, char* argv[]) {
         {"release", no_argument, 0, 'r'},
         {"target", required_argument, 0, 't'},
         {"jlevel", required_argument, 0, 'j'},
+        {"stats", no_argument, 0, 's'},
+        {"keep-going", no_argument, 0, 'k'},
+        {"quiet", no_argument, 0, 'q'},
+        {"link-jobs", required_argument, 0, 'l'},
         {0, 0, 0, 0}
     };
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "rgt:j:", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "rgkqt:j:", long_options, NULL)) != -1) {
         switch (opt) {
             case 'r':
                 cmdopts.release = true;
@@ -44,6 +47,22 @@ int dispatch_build(int argc, char* argv[]) {
             case 't':
                 cmdopts.targets = optarg;
                 break;
+            case 's':
+                cmdopts.stats = true;
+                break;
+            case 'k':
+                cmdopts.keep_going = true;
+                break;
+            case 'q':
+                cmdopts.quiet = true;
+                break;
+            case 'l':
+                cmdopts.link_jobs = strtol(optarg, NULL, 10);
+                if (cmdopts.link_jobs < 1) {
+                    printf("invalid link-jobs: must be >= 1\n");
+                    exit(1);
+                }
+                break;
             case 'j':
                 cmdopts.jlevel = strtol(optarg, NULL, 10);
                 if (cmdopts.jlevel < 1) {
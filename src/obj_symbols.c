@@ -0,0 +1,184 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2025 Josh Simonot
+ */
+
+#include "obj_symbols.h"
+
+#include "libcc/cc_files.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// only the few fields that are needed are read, at their offsets
+// in the ELF32/ELF64 headers, so no system elf.h is required
+#define ELF_CLASS32 1
+#define ELF_CLASS64 2
+#define ELF_DATA_LSB 1
+#define ELF_DATA_MSB 2
+#define ELF_TYPE_REL 1
+#define ELF_SHT_SYMTAB 2
+#define ELF_SHN_UNDEF 0
+#define ELF_STB_GLOBAL 1
+#define ELF_STB_WEAK 2
+
+struct elf_reader {
+    const uint8_t *data;
+    size_t size;
+    bool is64;
+    bool msb;
+};
+
+static bool in_bounds(const struct elf_reader *elf, uint64_t offset, uint64_t len) {
+    return offset <= elf->size && len <= elf->size - offset;
+}
+
+static uint64_t read_uint(const struct elf_reader *elf, uint64_t offset, int nbytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < nbytes; ++i) {
+        int shift = elf->msb ? 8 * (nbytes - 1 - i) : 8 * i;
+        value |= (uint64_t)elf->data[offset + i] << shift;
+    }
+    return value;
+}
+
+struct elf_section {
+    uint64_t offset;
+    uint64_t size;
+    uint32_t type;
+    uint32_t link;
+    uint64_t entsize;
+};
+
+static bool read_section(const struct elf_reader *elf, uint64_t shoff, uint64_t shentsize,
+                         uint64_t index, struct elf_section *section) {
+    uint64_t base = shoff + index * shentsize;
+    if (!in_bounds(elf, base, elf->is64 ? 64 : 40)) {
+        return false;
+    }
+    section->type = read_uint(elf, base + 4, 4);
+    if (elf->is64) {
+        section->offset = read_uint(elf, base + 24, 8);
+        section->size = read_uint(elf, base + 32, 8);
+        section->link = read_uint(elf, base + 40, 4);
+        section->entsize = read_uint(elf, base + 56, 8);
+    } else {
+        section->offset = read_uint(elf, base + 16, 4);
+        section->size = read_uint(elf, base + 20, 4);
+        section->link = read_uint(elf, base + 24, 4);
+        section->entsize = read_uint(elf, base + 36, 4);
+    }
+    return in_bounds(elf, section->offset, section->size);
+}
+
+static bool symtab_defines(const struct elf_reader *elf, const struct elf_section *symtab,
+                           const struct elf_section *strtab, const char *name) {
+    uint64_t symsize = elf->is64 ? 24 : 16;
+    if (symtab->entsize != 0 && symtab->entsize < symsize) {
+        return false;
+    }
+    if (symtab->entsize != 0) {
+        symsize = symtab->entsize;
+    }
+    size_t namelen = strlen(name);
+
+    for (uint64_t offset = symtab->offset; offset + symsize <= symtab->offset + symtab->size; offset += symsize) {
+        uint64_t nameoff = read_uint(elf, offset, 4);
+        uint8_t info;
+        uint64_t shndx;
+        if (elf->is64) {
+            info = elf->data[offset + 4];
+            shndx = read_uint(elf, offset + 6, 2);
+        } else {
+            info = elf->data[offset + 12];
+            shndx = read_uint(elf, offset + 14, 2);
+        }
+        int bind = info >> 4;
+        if (shndx == ELF_SHN_UNDEF || (bind != ELF_STB_GLOBAL && bind != ELF_STB_WEAK)) {
+            continue;
+        }
+        if (nameoff >= strtab->size || strtab->size - nameoff <= namelen) {
+            continue;
+        }
+        const char *symname = (const char *)elf->data + strtab->offset + nameoff;
+        if (memcmp(symname, name, namelen + 1) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int elf_defines_symbol(const struct elf_reader *elf_in, const char *name, bool *defined) {
+    struct elf_reader elf = *elf_in;
+    static const uint8_t magic[4] = {0x7f, 'E', 'L', 'F'};
+
+    if (elf.size < 52 || memcmp(elf.data, magic, sizeof magic) != 0) {
+        return -1;
+    }
+    if (elf.data[4] != ELF_CLASS32 && elf.data[4] != ELF_CLASS64) {
+        return -1;
+    }
+    if (elf.data[5] != ELF_DATA_LSB && elf.data[5] != ELF_DATA_MSB) {
+        return -1;
+    }
+    elf.is64 = elf.data[4] == ELF_CLASS64;
+    elf.msb = elf.data[5] == ELF_DATA_MSB;
+    if (elf.is64 && elf.size < 64) {
+        return -1;
+    }
+    if (read_uint(&elf, 16, 2) != ELF_TYPE_REL) {
+        return -1;
+    }
+
+    uint64_t shoff = elf.is64 ? read_uint(&elf, 40, 8) : read_uint(&elf, 32, 4);
+    uint64_t shentsize = read_uint(&elf, elf.is64 ? 58 : 46, 2);
+    uint64_t shnum = read_uint(&elf, elf.is64 ? 60 : 48, 2);
+    if (shoff == 0 || shentsize < (elf.is64 ? 64u : 40u)) {
+        return -1;
+    }
+
+    // with many sections the count is kept in the first section's size
+    struct elf_section section;
+    if (shnum == 0) {
+        if (!read_section(&elf, shoff, shentsize, 0, &section)) {
+            return -1;
+        }
+        shnum = section.size;
+    }
+    if (!in_bounds(&elf, shoff, shnum * shentsize)) {
+        return -1;
+    }
+
+    *defined = false;
+    for (uint64_t i = 0; i < shnum; ++i) {
+        if (!read_section(&elf, shoff, shentsize, i, &section) || section.type != ELF_SHT_SYMTAB) {
+            continue;
+        }
+        struct elf_section strtab;
+        if (section.link >= shnum || !read_section(&elf, shoff, shentsize, section.link, &strtab)) {
+            return -1;
+        }
+        if (symtab_defines(&elf, &section, &strtab, name)) {
+            *defined = true;
+            break;
+        }
+    }
+    return 0;
+}
+
+int obj_defines_symbol(const char *objpath, const char *name, bool *defined) {
+    ccstrview contents;
+    if (ccfs_map_readonly(objpath, &contents) != 0) {
+        return -1;
+    }
+    struct elf_reader elf = {
+        .data = (const uint8_t *)contents.cstr,
+        .size = contents.len,
+    };
+    int ret = elf_defines_symbol(&elf, name, defined);
+    ccfs_unmap(&contents);
+    return ret;
+}
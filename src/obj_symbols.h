@@ -0,0 +1,23 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2025 Josh Simonot
+ */
+
+#ifndef _OBJ_SYMBOLS_H_
+#define _OBJ_SYMBOLS_H_
+
+#include <stdbool.h>
+
+// Reads the symbol table of an ELF object file (32 or 64 bit, either
+// byte order) directly, without spawning nm.
+//
+// Sets *defined if the object defines a global (or weak) symbol with
+// the given name. Returns -1 if the file can't be read or is not an
+// ELF relocatable object, in which case the caller has to rely on
+// whatever it knew before.
+int obj_defines_symbol(const char *objpath, const char *name, bool *defined);
+
+#endif // _OBJ_SYMBOLS_H_
@@ -0,0 +1,215 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2025 Josh Simonot
+ */
+
+#include "process.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+
+// no process tracking, running commands finish on their own
+static bool terminating;
+
+int process_run(const struct command *cmd) {
+    if (terminating) {
+        return -1;
+    }
+    return system(cmd->line);
+}
+
+void process_terminate_all(void) {
+    terminating = true;
+}
+
+bool process_terminating(void) {
+    return terminating;
+}
+
+#else
+
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+// a child stays tracked until right before it is reaped, only then
+// could its pid be reused by an unrelated process
+struct running_process {
+    pid_t pid;
+    int pidfd; // -1 unless set
+};
+
+static pthread_mutex_t running_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct running_process *running;
+static size_t nrunning;
+static size_t runningcap;
+static bool terminating;
+
+static void terminate(const struct running_process *process) {
+#ifdef SYS_pidfd_send_signal
+    if (process->pidfd != -1 && syscall(SYS_pidfd_send_signal, process->pidfd, SIGTERM, NULL, 0) == 0) {
+        return;
+    }
+#endif
+    kill(process->pid, SIGTERM);
+}
+
+// registers the child, unless the build is already being stopped
+static void track(pid_t pid) {
+    pthread_mutex_lock(&running_lock);
+    if (terminating) {
+        pthread_mutex_unlock(&running_lock);
+        kill(pid, SIGTERM);
+        return;
+    }
+    if (nrunning == runningcap) {
+        runningcap = runningcap ? 2 * runningcap : 16;
+        running = realloc(running, runningcap * sizeof *running);
+        if (running == NULL) {
+            printf("%s: out of memory\n", __func__);
+            abort();
+        }
+    }
+    running[nrunning++] = (struct running_process){ pid, -1 };
+    pthread_mutex_unlock(&running_lock);
+}
+
+static void untrack(pid_t pid) {
+    pthread_mutex_lock(&running_lock);
+    for (size_t i = 0; i < nrunning; ++i) {
+        if (running[i].pid == pid) {
+            running[i] = running[--nrunning];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&running_lock);
+}
+
+void process_set_pidfd(pid_t pid, int pidfd) {
+    pthread_mutex_lock(&running_lock);
+    for (size_t i = 0; i < nrunning; ++i) {
+        if (running[i].pid == pid) {
+            running[i].pidfd = pidfd;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&running_lock);
+}
+
+// posix_spawn neither copies the page tables of the build, like fork
+// does, nor starts a shell unless the command needs one
+pid_t process_spawn(const struct command *cmd, int outfd) {
+    if (process_terminating()) {
+        return -1;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (outfd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, outfd, STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, outfd, STDERR_FILENO);
+    }
+
+    pid_t pid;
+    int err;
+    if (cmd->argv != NULL) {
+        err = posix_spawnp(&pid, cmd->argv[0], &actions, NULL, cmd->argv, environ);
+    } else {
+        char *argv[] = { "sh", "-c", cmd->line, NULL };
+        err = posix_spawn(&pid, "/bin/sh", &actions, NULL, argv, environ);
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    if (err != 0) {
+        printf("error: failed to start '%s': %s\n", cmd->argv ? cmd->argv[0] : cmd->line, strerror(err));
+        return -1;
+    }
+    track(pid);
+    return pid;
+}
+
+static int exit_code(int status) {
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
+
+// untracks the exited child before reaping it, so the pid can't be
+// signalled by process_terminate_all once it is free to be reused
+static int reap(pid_t pid) {
+    untrack(pid);
+    int status;
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return exit_code(status);
+}
+
+int process_wait(pid_t pid) {
+    siginfo_t info;
+    while (waitid(P_PID, pid, &info, WEXITED | WNOWAIT) == -1) {
+        if (errno != EINTR) {
+            untrack(pid);
+            return -1;
+        }
+    }
+    return reap(pid);
+}
+
+bool process_poll(pid_t pid, int *code) {
+    siginfo_t info;
+    info.si_pid = 0;
+    int ret = waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT);
+    if ((ret == 0 && info.si_pid == 0) || (ret == -1 && errno == EINTR)) {
+        return false;
+    }
+    if (ret == -1) {
+        untrack(pid);
+        *code = -1;
+        return true;
+    }
+    *code = reap(pid);
+    return true;
+}
+
+int process_run(const struct command *cmd) {
+    pid_t pid = process_spawn(cmd, -1);
+    if (pid == -1) {
+        return -1;
+    }
+    return process_wait(pid);
+}
+
+void process_terminate_all(void) {
+    pthread_mutex_lock(&running_lock);
+    terminating = true;
+    for (size_t i = 0; i < nrunning; ++i) {
+        terminate(&running[i]);
+    }
+    pthread_mutex_unlock(&running_lock);
+}
+
+bool process_terminating(void) {
+    pthread_mutex_lock(&running_lock);
+    bool stopped = terminating;
+    pthread_mutex_unlock(&running_lock);
+    return stopped;
+}
+
+#endif
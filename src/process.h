@@ -0,0 +1,51 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2025 Josh Simonot
+ */
+
+#ifndef _PROCESS_H_
+#define _PROCESS_H_
+
+#include "command.h"
+
+#include <stdbool.h>
+
+// Starts the build commands, directly from their argv or through the
+// shell when they need one, and keeps track of the running ones so a
+// failing build can stop them.
+
+// runs the command and waits for it, returns its exit code (128 + the
+// signal number if it was killed), or -1 if it could not be started
+// or the running commands were terminated before it started
+int process_run(const struct command *cmd);
+
+#ifndef _WIN32
+#include <sys/types.h>
+
+// starts the command without waiting for it, returns -1 like process_run,
+// its stdout and stderr go to outfd unless it is -1
+pid_t process_spawn(const struct command *cmd, int outfd);
+
+// reaps a started command and returns its exit code like process_run,
+// process_poll returns false instead of waiting if it is still running
+int process_wait(pid_t pid);
+bool process_poll(pid_t pid, int *code);
+
+// the command is signalled through its pidfd from now on, which can't
+// reach another process should the pid be reused, the pidfd must stay
+// open until the command was reaped
+void process_set_pidfd(pid_t pid, int pidfd);
+#endif
+
+// signals every running command to terminate, and makes any later
+// process_run fail without starting its command
+void process_terminate_all(void);
+
+// the running commands were terminated, a command failing now most
+// likely failed because of that
+bool process_terminating(void);
+
+#endif // _PROCESS_H_
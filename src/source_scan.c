@@ -0,0 +1,441 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2025 Josh Simonot
+ */
+
+#include "source_scan.h"
+
+#include "libcc/cc_files.h"
+
+#include <limits.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+struct scanner {
+    const char *begin;
+    const char *end;
+    void *ctx;
+    source_include_cb include_cb;
+    bool *entry_point;
+    bool want_main;
+    bool stop;
+    int skip_depth; // nesting depth inside an #if 0 group
+    bool special[256];
+};
+
+static inline bool is_ident(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+        || (c >= '0' && c <= '9') || c == '_' || (unsigned char)c >= 0x80;
+}
+
+static inline bool is_hspace(char c) {
+    return c == ' ' || c == '\t' || c == '\f' || c == '\v' || c == '\r';
+}
+
+static void set_special(struct scanner *s) {
+    memset(s->special, 0, sizeof s->special);
+    s->special['/'] = true;
+    s->special['"'] = true;
+    s->special['\''] = true;
+    s->special['#'] = true;
+    s->special['m'] = s->want_main;
+}
+
+// returns the next byte that may start a comment, literal,
+// directive or the main function
+static const char* find_special(const struct scanner *s, const char *p) {
+    const char *end = s->end;
+    const char m = s->want_main ? 'm' : '/';
+
+    #if defined(__AVX2__)
+    const __m256i slash32 = _mm256_set1_epi8('/');
+    const __m256i dquote32 = _mm256_set1_epi8('"');
+    const __m256i squote32 = _mm256_set1_epi8('\'');
+    const __m256i hash32 = _mm256_set1_epi8('#');
+    const __m256i m32 = _mm256_set1_epi8(m);
+    while (end - p >= 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)p);
+        __m256i hits = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, slash32), _mm256_cmpeq_epi8(chunk, dquote32)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, squote32),
+                _mm256_or_si256(_mm256_cmpeq_epi8(chunk, hash32), _mm256_cmpeq_epi8(chunk, m32))));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hits);
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+    #endif
+
+    #if defined(__SSE2__)
+    const __m128i slash = _mm_set1_epi8('/');
+    const __m128i dquote = _mm_set1_epi8('"');
+    const __m128i squote = _mm_set1_epi8('\'');
+    const __m128i hash = _mm_set1_epi8('#');
+    const __m128i m16 = _mm_set1_epi8(m);
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+        __m128i hits = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, slash), _mm_cmpeq_epi8(chunk, dquote)),
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, squote),
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, hash), _mm_cmpeq_epi8(chunk, m16))));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hits);
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+    #endif
+
+    (void)m;
+    while (p < end && !s->special[(unsigned char)*p]) {
+        ++p;
+    }
+    return p;
+}
+
+// true if the newline at nl is escaped by a backslash
+static bool is_continued(const struct scanner *s, const char *nl) {
+    if (nl > s->begin && nl[-1] == '\r') {
+        --nl;
+    }
+    return nl > s->begin && nl[-1] == '\\';
+}
+
+// returns the newline ending the logical line, following continuations
+static const char* skip_line(const struct scanner *s, const char *p) {
+    for (;;) {
+        const char *nl = memchr(p, '\n', s->end - p);
+        if (nl == NULL) {
+            return s->end;
+        }
+        if (!is_continued(s, nl)) {
+            return nl;
+        }
+        p = nl + 1;
+    }
+}
+
+// p points just past the opening "/*"
+static const char* skip_block_comment(const struct scanner *s, const char *p) {
+    const char *start = p;
+    while (p < s->end) {
+        const char *slash = memchr(p, '/', s->end - p);
+        if (slash == NULL) {
+            return s->end;
+        }
+        if (slash > start && slash[-1] == '*') {
+            return slash + 1;
+        }
+        p = slash + 1;
+    }
+    return s->end;
+}
+
+// p points just past the opening quote, an unterminated literal
+// ends at the newline so it can't swallow the rest of the file
+static const char* skip_quoted(const struct scanner *s, const char *p, char quote) {
+    while (p < s->end) {
+        char c = *p++;
+        if (c == '\\') {
+            if (p < s->end) {
+                ++p;
+            }
+        } else if (c == quote || c == '\n') {
+            return p;
+        }
+    }
+    return s->end;
+}
+
+// p points just past R" of a C++ raw string: R"delim( ... )delim"
+static const char* skip_raw_string(const struct scanner *s, const char *p) {
+    const char *delim = p;
+    while (p < s->end && *p != '(' && p - delim <= 16) {
+        ++p;
+    }
+    if (p >= s->end || *p != '(') {
+        return p; // not a raw string after all
+    }
+    size_t dlen = p - delim;
+    ++p;
+
+    while (p < s->end) {
+        const char *close = memchr(p, ')', s->end - p);
+        if (close == NULL) {
+            return s->end;
+        }
+        if ((size_t)(s->end - close) > dlen + 1
+            && memcmp(close + 1, delim, dlen) == 0
+            && close[1 + dlen] == '"') {
+            return close + 2 + dlen;
+        }
+        p = close + 1;
+    }
+    return s->end;
+}
+
+// start of the identifier or number that ends just before p
+static const char* token_start(const struct scanner *s, const char *p) {
+    while (p > s->begin && is_ident(p[-1])) {
+        --p;
+    }
+    return p;
+}
+
+// R"( ... )" along with its encoding prefixes LR, uR, UR and u8R
+static bool is_raw_string(const struct scanner *s, const char *quote) {
+    if (quote == s->begin || quote[-1] != 'R') {
+        return false;
+    }
+    const char *start = token_start(s, quote);
+    size_t len = quote - start;
+    return (len == 1)
+        || (len == 2 && (start[0] == 'L' || start[0] == 'u' || start[0] == 'U'))
+        || (len == 3 && start[0] == 'u' && start[1] == '8');
+}
+
+// C++14 digit separators (1'000'000) are not character literals
+static bool is_digit_separator(const struct scanner *s, const char *quote) {
+    const char *start = token_start(s, quote);
+    return start < quote && *start >= '0' && *start <= '9';
+}
+
+// a directive's '#' is the first token on its logical line
+static bool at_line_start(const struct scanner *s, const char *hash) {
+    const char *p = hash;
+    while (p > s->begin && is_hspace(p[-1])) {
+        --p;
+    }
+    if (p == s->begin) {
+        return true;
+    }
+    return p[-1] == '\n' && !is_continued(s, p - 1);
+}
+
+// skips whitespace, comments and line continuations within a directive
+static const char* skip_directive_space(const struct scanner *s, const char *p) {
+    while (p < s->end) {
+        if (is_hspace(*p)) {
+            ++p;
+        } else if (p[0] == '\\' && p + 1 < s->end && p[1] == '\n') {
+            p += 2;
+        } else if (p[0] == '\\' && p + 2 < s->end && p[1] == '\r' && p[2] == '\n') {
+            p += 3;
+        } else if (p[0] == '/' && p + 1 < s->end && p[1] == '*') {
+            p = skip_block_comment(s, p + 2);
+        } else {
+            break;
+        }
+    }
+    return p;
+}
+
+static bool is_word(const char *word, size_t len, const char *expected) {
+    return len == strlen(expected) && memcmp(word, expected, len) == 0;
+}
+
+static bool is_include(const char *name, size_t len) {
+    return is_word(name, len, "include")
+        || is_word(name, len, "include_next")
+        || is_word(name, len, "import");
+}
+
+static bool is_conditional(const char *name, size_t len) {
+    return is_word(name, len, "if")
+        || is_word(name, len, "ifdef")
+        || is_word(name, len, "ifndef");
+}
+
+static bool is_alternative(const char *name, size_t len) {
+    return is_word(name, len, "else")
+        || is_word(name, len, "elif")
+        || is_word(name, len, "elifdef")
+        || is_word(name, len, "elifndef");
+}
+
+// tracks the nesting of conditionals within an #if 0 group, the
+// group ends at its #endif or at an alternative that may be taken
+static void skip_group_directive(struct scanner *s, const char *name, size_t len) {
+    if (is_conditional(name, len)) {
+        ++s->skip_depth;
+    } else if (is_word(name, len, "endif")) {
+        --s->skip_depth;
+    } else if (s->skip_depth == 1 && is_alternative(name, len)) {
+        s->skip_depth = 0;
+    }
+}
+
+// p points just past the '#', returns where scanning continues,
+// the rest of the directive line is scanned as usual
+static const char* scan_directive(struct scanner *s, const char *p) {
+    p = skip_directive_space(s, p);
+
+    const char *name = p;
+    while (p < s->end && is_ident(*p)) {
+        ++p;
+    }
+    size_t namelen = p - name;
+
+    if (s->skip_depth > 0) {
+        skip_group_directive(s, name, namelen);
+        return p;
+    }
+    if (is_word(name, namelen, "if")) {
+        // only the literal "#if 0" is known to be dead code, a condition
+        // that goes on after the 0 ("#if 0 || defined(X)") may be live
+        const char *cond = skip_directive_space(s, p);
+        if (cond >= s->end || *cond != '0') {
+            return p;
+        }
+        const char *rest = skip_directive_space(s, cond + 1);
+        bool line_ends = rest >= s->end || *rest == '\n' || *rest == '\r'
+                      || (rest[0] == '/' && rest + 1 < s->end && rest[1] == '/');
+        if (line_ends) {
+            s->skip_depth = 1;
+            return rest;
+        }
+        return p;
+    }
+    if (s->include_cb == NULL || !is_include(name, namelen)) {
+        return p;
+    }
+    p = skip_directive_space(s, p);
+    if (p >= s->end || (*p != '<' && *p != '"')) {
+        return p; // computed include, can't be followed
+    }
+    char close = (*p == '<') ? '>' : '"';
+    const char *start = ++p;
+    while (p < s->end && *p != close && *p != '\n') {
+        ++p;
+    }
+    if (p >= s->end || *p != close) {
+        return p;
+    }
+
+    char header[PATH_MAX];
+    size_t len = p - start;
+    if (len >= sizeof header) {
+        return p + 1;
+    }
+    memcpy(header, start, len);
+    header[len] = 0;
+
+    if (s->include_cb(s->ctx, header, close == '"') == -1) {
+        s->stop = true;
+    }
+    return p + 1;
+}
+
+// q points at an 'm', matches "int main(" and "auto main(" (with a
+// trailing return type) with any whitespace between
+static const char* scan_main(struct scanner *s, const char *q) {
+    const char *p = q + 1;
+    if (s->skip_depth > 0 || (q > s->begin && is_ident(q[-1]))) {
+        return p;
+    }
+    if (s->end - q < 4 || memcmp(q, "main", 4) != 0) {
+        return p;
+    }
+    p = q + 4;
+    if (p < s->end && is_ident(*p)) {
+        return p;
+    }
+
+    const char *after = p;
+    while (after < s->end && (is_hspace(*after) || *after == '\n')) {
+        ++after;
+    }
+    if (after >= s->end || *after != '(') {
+        return p;
+    }
+    const char *before = q;
+    while (before > s->begin && (is_hspace(before[-1]) || before[-1] == '\n')) {
+        --before;
+    }
+    const char *type = token_start(s, before);
+    if (!is_word(type, before - type, "int") && !is_word(type, before - type, "auto")) {
+        return p;
+    }
+
+    *s->entry_point = true;
+    s->want_main = false;
+    s->special['m'] = false;
+    if (s->include_cb == NULL) {
+        s->stop = true;
+    }
+    return p;
+}
+
+void scan_source(const char *data, size_t len, void *ctx, source_include_cb include_cb, bool *entry_point) {
+    struct scanner s = {
+        .begin = data,
+        .end = data + len,
+        .ctx = ctx,
+        .include_cb = include_cb,
+        .entry_point = entry_point,
+        .want_main = entry_point != NULL,
+    };
+    if (entry_point != NULL) {
+        *entry_point = false;
+    }
+    set_special(&s);
+
+    const char *p = data;
+    while (!s.stop && (p = find_special(&s, p)) < s.end) {
+        switch (*p) {
+        case '/':
+            if (p + 1 < s.end && p[1] == '/') {
+                p = skip_line(&s, p + 2);
+            } else if (p + 1 < s.end && p[1] == '*') {
+                p = skip_block_comment(&s, p + 2);
+            } else {
+                ++p;
+            }
+            break;
+        case '"':
+            if (is_raw_string(&s, p)) {
+                p = skip_raw_string(&s, p + 1);
+            } else {
+                p = skip_quoted(&s, p + 1, '"');
+            }
+            break;
+        case '\'':
+            if (is_digit_separator(&s, p)) {
+                ++p;
+            } else {
+                p = skip_quoted(&s, p + 1, '\'');
+            }
+            break;
+        case '#':
+            if (at_line_start(&s, p)) {
+                p = scan_directive(&s, p + 1);
+            } else {
+                ++p;
+            }
+            break;
+        default:
+            p = scan_main(&s, p);
+            break;
+        }
+    }
+}
+
+int scan_source_file(const char *path, void *ctx, source_include_cb include_cb, bool *entry_point) {
+    if (entry_point != NULL) {
+        *entry_point = false;
+    }
+    ccstrview contents;
+    if (ccfs_map_readonly(path, &contents) != 0) {
+        return -1;
+    }
+    scan_source(contents.cstr, contents.len, ctx, include_cb, entry_point);
+    ccfs_unmap(&contents);
+    return 0;
+}
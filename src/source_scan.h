@@ -0,0 +1,36 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2025 Josh Simonot
+ */
+
+#ifndef _SOURCE_SCAN_H_
+#define _SOURCE_SCAN_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Reads a source file in a single pass, reporting its include
+// directives and whether it defines an entry point (main function).
+//
+// Comments, string and character literals are skipped so neither
+// can produce false matches, as are groups disabled with #if 0.
+// Directives may be indented, have space after the '#', and be
+// continued over several lines. Bytes that can't start anything
+// of interest are skipped with vector compares.
+
+// called for every #include with the spelling between the
+// quotes or brackets, returning -1 stops the scan
+typedef int (*source_include_cb)(void *ctx, const char *header, bool quoted);
+
+// include_cb may be NULL if only the entry point is wanted, and
+// entry_point may be NULL if only the includes are wanted
+void scan_source(const char *data, size_t len, void *ctx, source_include_cb include_cb, bool *entry_point);
+
+// returns -1 if the file can't be read, which usually just means the
+// header is from outside the project (system includes)
+int scan_source_file(const char *path, void *ctx, source_include_cb include_cb, bool *entry_point);
+
+#endif // _SOURCE_SCAN_H_